@@ -0,0 +1,36 @@
+#version 330 core
+// The level drawn as plain triangles instead of 3-vertex instances: vertex 3t + k is corner k of
+// triangle t, whose translation and rotation are fetched from the instance page's buffers
+// through buffer textures. Nothing is bound as a vertex attribute.
+
+out vec3 fColor;
+
+layout (std140) uniform Matrices
+{
+    mat4 projection;
+    mat4 view;
+};
+
+// the page's translations (3 floats per triangle, GL_R32F) and rotations (GL_RGBA32F)
+uniform samplerBuffer translations;
+uniform samplerBuffer rotations;
+
+// corners of the base triangle
+uniform vec3 corners[3];
+
+#include "quaternion.glsl"
+
+void main()
+{
+    int triangle = gl_VertexID / 3;
+    int corner = gl_VertexID - 3 * triangle;
+
+    vec3 offset = vec3(texelFetch(translations, 3 * triangle).r,
+                       texelFetch(translations, 3 * triangle + 1).r,
+                       texelFetch(translations, 3 * triangle + 2).r);
+    vec4 quat = texelFetch(rotations, triangle);
+
+    fColor = vec3((offset.x+1)/2, (offset.y+1)/2, (offset.z+1)/2);
+
+    gl_Position = projection * view * vec4(quatRotate(quat, corners[corner]) + offset, 1);
+}
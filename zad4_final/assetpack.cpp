@@ -0,0 +1,122 @@
+// assetpack: packs asset files into one archive that FileSystem::mount serves them from without copies
+//   ./assetpack archive.pak file...
+// every file has to be under the archive's directory and is stored by its path relative to it, the
+// name the program asks for it by (see learnopengl/filesystem.h); shaders, models with their .cache
+// files, textures with their .mips files all go in. Files left out are still read loose.
+#include "learnopengl/filesystem.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <climits>
+#include <unistd.h>
+
+struct PackedFile
+{
+    std::string name;
+    Asset data;
+    time_t modified;
+};
+
+int main( int argc, char** argv )
+{
+    if (argc < 3)
+    {
+        std::cout << "usage: " << argv[0] << " archive.pak file..." << std::endl;
+        return 1;
+    }
+    std::string archivePath = argv[1];
+    std::string::size_type slash = archivePath.find_last_of('/');
+    std::string directory = slash == std::string::npos ? "." : archivePath.substr(0, slash);
+    char resolved[PATH_MAX];
+    if (realpath(directory.c_str(), resolved) == nullptr)
+    {
+        std::cout << directory << ": no such directory" << std::endl;
+        return 1;
+    }
+    std::string root = std::string(resolved) + "/";
+
+    std::vector<PackedFile> files;
+    int failures = 0;
+    for (int i = 2; i < argc; i++)
+    {
+        std::string path = FileSystem::canonicalPath(argv[i]);
+        if (path.compare(0, root.size(), root) != 0)
+        {
+            std::cout << argv[i] << ": not under " << root << std::endl;
+            failures++;
+            continue;
+        }
+        PackedFile file;
+        file.name = path.substr(root.size());
+        file.data = FileSystem::open(path);
+        file.modified = FileSystem::modifiedTime(path);
+        if (!file.data.valid())
+        {
+            std::cout << argv[i] << ": can't read" << std::endl;
+            failures++;
+            continue;
+        }
+        files.push_back(std::move(file));
+    }
+    if (failures > 0)
+        return 1;
+
+    // header, entries, names, then the data 16-byte aligned
+    std::vector<ArchiveEntry> entries(files.size());
+    uint64_t offset = sizeof(ArchiveHeader) + entries.size() * sizeof(ArchiveEntry);
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        entries[i].nameOffset = offset;
+        entries[i].nameLength = files[i].name.size();
+        offset += files[i].name.size();
+    }
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        offset = (offset + 15) & ~(uint64_t)15;
+        entries[i].dataOffset = offset;
+        entries[i].size = files[i].data.size();
+        entries[i].modified = files[i].modified;
+        offset += files[i].data.size();
+    }
+
+    // through a temporary file, the running program may have the old archive mounted
+    std::string temporary = archivePath + ".tmp" + std::to_string((unsigned long)getpid());
+    FILE* out = fopen(temporary.c_str(), "wb");
+    if (out == nullptr)
+    {
+        std::cout << archivePath << ": can't write" << std::endl;
+        return 1;
+    }
+    ArchiveHeader header;
+    std::memcpy(header.magic, "APAK", 4);
+    header.version = ARCHIVE_VERSION;
+    header.entryCount = entries.size();
+    header.reserved = 0;
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+              fwrite(entries.data(), sizeof(ArchiveEntry), entries.size(), out) == entries.size();
+    for (size_t i = 0; ok && i < files.size(); i++)
+        ok = fwrite(files[i].name.data(), 1, files[i].name.size(), out) == files[i].name.size();
+    const char zeros[16] = { 0 };
+    uint64_t written = entries.empty() ? 0 : entries[0].nameOffset;
+    for (size_t i = 0; i < files.size(); i++)
+        written += files[i].name.size();
+    for (size_t i = 0; ok && i < files.size(); i++)
+    {
+        ok = fwrite(zeros, 1, entries[i].dataOffset - written, out) == entries[i].dataOffset - written &&
+             fwrite(files[i].data.data(), 1, files[i].data.size(), out) == files[i].data.size();
+        written = entries[i].dataOffset + entries[i].size;
+    }
+    ok = fclose(out) == 0 && ok;
+    if (ok)
+        ok = rename(temporary.c_str(), archivePath.c_str()) == 0;
+    if (!ok)
+    {
+        remove(temporary.c_str());
+        std::cout << archivePath << ": can't write" << std::endl;
+        return 1;
+    }
+    std::cout << archivePath << ": " << files.size() << " files, " << offset / 1024 << "KB" << std::endl;
+    return 0;
+}
@@ -0,0 +1,515 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <glm/glm.hpp>
+
+#include "collision.h"
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cfloat>
+#include <cstddef>
+
+struct AABB
+{
+    glm::vec3 min;
+    glm::vec3 max;
+
+    // empty box, growing it by anything gives that thing's bounds
+    AABB() : min(FLT_MAX), max(-FLT_MAX) {}
+
+    AABB(glm::vec3 min, glm::vec3 max) : min(min), max(max) {}
+
+    void grow(glm::vec3 p)
+    {
+        min = glm::min(min, p);
+        max = glm::max(max, p);
+    }
+
+    void grow(const AABB &box)
+    {
+        min = glm::min(min, box.min);
+        max = glm::max(max, box.max);
+    }
+
+    bool empty() const
+    {
+        return min.x > max.x || min.y > max.y || min.z > max.z;
+    }
+
+    glm::vec3 center() const
+    {
+        return 0.5f * (min + max);
+    }
+
+    float area() const
+    {
+        if (empty())
+            return 0.0f;
+        glm::vec3 d = max - min;
+        return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
+    // squared distance from p to the box, 0 inside
+    float distance2(glm::vec3 p) const
+    {
+        glm::vec3 d = glm::max(glm::max(min - p, p - max), glm::vec3(0.0f));
+        return glm::dot(d, d);
+    }
+
+    // whether origin + t * direction enters the box for some t in [0, maxT]; invDirection = 1 / direction
+    bool intersectsRay(glm::vec3 origin, glm::vec3 invDirection, float maxT) const
+    {
+        glm::vec3 t0 = (min - origin) * invDirection;
+        glm::vec3 t1 = (max - origin) * invDirection;
+        glm::vec3 tNear = glm::min(t0, t1), tFar = glm::max(t0, t1);
+        float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+        float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxT));
+        return enter <= exit;
+    }
+
+    bool operator==(const AABB &other) const
+    {
+        return min == other.min && max == other.max;
+    }
+};
+
+inline AABB triangleBounds(const Triangle &triangle)
+{
+    AABB box;
+    box.grow(triangle.A);
+    box.grow(triangle.B);
+    box.grow(triangle.C);
+    return box;
+}
+
+// Bounding volume hierarchy over the boxes of a set of primitives (triangles here), built top-down
+// with a binned SAH. Primitives that move are updated one by one and refit() fixes the bounds
+// bottom-up from the changed leaves only. Refitting keeps the tree exact but lets its quality
+// drop; the SAH cost is kept up to date with every refit, and once it has grown past
+// rebuildThreshold times the cost of a fresh build, a new tree is built on a worker thread from
+// a snapshot of the boxes. Until it is ready the old tree keeps answering queries; when it is
+// adopted, everything that moved since the snapshot is refit into it first, so queries stay
+// exact through the switch.
+class BVH
+{
+public:
+    static constexpr size_t NO_NODE = ~(size_t)0;
+
+    struct Node
+    {
+        AABB bounds;
+        size_t parent;
+        // leaf: first entry in order, inner node: left child (the right child is first + 1)
+        size_t first;
+        // number of primitives of a leaf, 0 for inner nodes
+        size_t count;
+    };
+
+    // cost of a refitted tree relative to a fresh one that starts a background rebuild
+    float rebuildThreshold;
+    unsigned int rebuilds;
+
+    BVH() : rebuildThreshold(1.25f), rebuilds(0), rebuilding(false), pendingReady(false)
+    {
+    }
+
+    ~BVH()
+    {
+        if (worker.joinable())
+            worker.join();
+    }
+
+    // build synchronously, boxes[i] are the bounds of primitive i
+    // ------------------------------------------------------------------------
+    void build(const std::vector<AABB> &primitiveBoxes)
+    {
+        if (worker.joinable())
+            worker.join();
+        rebuilding = false;
+        pendingReady = false;
+
+        boxes = primitiveBoxes;
+        buildTree(boxes, current);
+        dirty.assign(current.nodes.size(), 0);
+        dirtyLeaves.clear();
+        builtCost = sahCost();
+    }
+
+    // a background rebuild is running or waits to be adopted by refit()
+    bool rebuildPending() const
+    {
+        return rebuilding;
+    }
+
+    size_t nodeCount() const
+    {
+        return current.nodes.size();
+    }
+
+    // SAH cost of the tree: expected traversal and intersection work for a random query
+    // ------------------------------------------------------------------------
+    float sahCost() const
+    {
+        if (current.nodes.empty() || current.nodes[0].bounds.area() == 0.0f)
+            return 0.0f;
+        return (float)(current.sah / current.nodes[0].bounds.area());
+    }
+
+    // primitive moved; the tree is fixed up in the next refit()
+    // ------------------------------------------------------------------------
+    void update(size_t primitive, const AABB &box)
+    {
+        boxes[primitive] = box;
+        markDirty(primitive);
+        if (rebuilding)
+            changedSinceSnapshot.push_back(primitive);
+    }
+
+    // fix the bounds above every updated primitive, adopt a finished rebuild or start one
+    // ------------------------------------------------------------------------
+    void refit()
+    {
+        if (rebuilding && pendingReady)
+            adoptRebuild();
+
+        for (size_t leaf : dirtyLeaves)
+        {
+            dirty[leaf] = 0;
+            refitUpwards(leaf);
+        }
+        dirtyLeaves.clear();
+
+        if (!rebuilding && !current.nodes.empty() && sahCost() > rebuildThreshold * builtCost)
+            startRebuild();
+    }
+
+    // every primitive whose box is within radius of center
+    // ------------------------------------------------------------------------
+    void query(glm::vec3 center, float radius, std::vector<size_t> &result) const
+    {
+        result.clear();
+        if (current.nodes.empty())
+            return;
+
+        float radius2 = radius * radius;
+        std::vector<size_t> stack;
+        stack.reserve(64);
+        stack.push_back(0);
+        while (!stack.empty())
+        {
+            const Node &node = current.nodes[stack.back()];
+            stack.pop_back();
+            if (node.bounds.distance2(center) > radius2)
+                continue;
+
+            if (node.count > 0)
+            {
+                for (size_t i = node.first; i < node.first + node.count; i++)
+                    if (boxes[current.order[i]].distance2(center) <= radius2)
+                        result.push_back(current.order[i]);
+            }
+            else
+            {
+                stack.push_back(node.first);
+                stack.push_back(node.first + 1);
+            }
+        }
+    }
+
+    // every primitive whose box the segment origin + t * direction, t in [0, maxT], passes through
+    // ------------------------------------------------------------------------
+    void raycast(glm::vec3 origin, glm::vec3 direction, float maxT, std::vector<size_t> &result) const
+    {
+        result.clear();
+        if (current.nodes.empty())
+            return;
+
+        // a zero component gives +-inf, which the slab test handles
+        glm::vec3 invDirection = 1.0f / direction;
+        std::vector<size_t> stack;
+        stack.reserve(64);
+        stack.push_back(0);
+        while (!stack.empty())
+        {
+            const Node &node = current.nodes[stack.back()];
+            stack.pop_back();
+            if (!node.bounds.intersectsRay(origin, invDirection, maxT))
+                continue;
+
+            if (node.count > 0)
+            {
+                for (size_t i = node.first; i < node.first + node.count; i++)
+                    if (boxes[current.order[i]].intersectsRay(origin, invDirection, maxT))
+                        result.push_back(current.order[i]);
+            }
+            else
+            {
+                stack.push_back(node.first);
+                stack.push_back(node.first + 1);
+            }
+        }
+    }
+
+private:
+    static constexpr size_t MAX_LEAF_SIZE = 4;
+    static constexpr int BIN_COUNT = 12;
+
+    struct Tree
+    {
+        std::vector<Node> nodes;
+        // primitives in leaf order, leaves reference ranges of it
+        std::vector<size_t> order;
+        // leaf of every primitive
+        std::vector<size_t> leafOf;
+        // unnormalized SAH cost: sum of area * weight over all nodes
+        double sah;
+    };
+
+    std::vector<AABB> boxes;
+    Tree current;
+    float builtCost;
+    std::vector<unsigned char> dirty;
+    std::vector<size_t> dirtyLeaves;
+
+    // background rebuild
+    std::thread worker;
+    bool rebuilding;
+    std::atomic<bool> pendingReady;
+    std::vector<AABB> snapshot;
+    Tree pending;
+    std::vector<size_t> changedSinceSnapshot;
+
+    // traversal costs 1, testing a primitive costs 1
+    static double nodeWeight(const Node &node)
+    {
+        return node.count > 0 ? (double)node.count : 1.0;
+    }
+
+    void markDirty(size_t primitive)
+    {
+        size_t leaf = current.leafOf[primitive];
+        if (dirty[leaf])
+            return;
+        dirty[leaf] = 1;
+        dirtyLeaves.push_back(leaf);
+    }
+
+    void refitUpwards(size_t index)
+    {
+        while (index != NO_NODE)
+        {
+            Node &node = current.nodes[index];
+            AABB bounds;
+            if (node.count > 0)
+            {
+                for (size_t i = node.first; i < node.first + node.count; i++)
+                    bounds.grow(boxes[current.order[i]]);
+            }
+            else
+            {
+                bounds.grow(current.nodes[node.first].bounds);
+                bounds.grow(current.nodes[node.first + 1].bounds);
+            }
+
+            // nothing above changes either
+            if (bounds == node.bounds)
+                return;
+
+            current.sah += nodeWeight(node) * (bounds.area() - node.bounds.area());
+            node.bounds = bounds;
+            index = node.parent;
+        }
+    }
+
+    void startRebuild()
+    {
+        snapshot = boxes;
+        changedSinceSnapshot.clear();
+        pendingReady = false;
+        rebuilding = true;
+        worker = std::thread([this]() {
+            buildTree(snapshot, pending);
+            pendingReady = true;
+        });
+    }
+
+    void adoptRebuild()
+    {
+        worker.join();
+        rebuilding = false;
+        pendingReady = false;
+
+        std::swap(current, pending);
+        pending = Tree();
+        std::vector<AABB>().swap(snapshot);
+        builtCost = sahCost();
+        rebuilds++;
+
+        // the new tree was built from the snapshot, bring it up to date before it answers queries
+        dirty.assign(current.nodes.size(), 0);
+        dirtyLeaves.clear();
+        for (size_t primitive : changedSinceSnapshot)
+            markDirty(primitive);
+        changedSinceSnapshot.clear();
+    }
+
+    // binned SAH build, runs on the render thread for build() and on the worker for rebuilds
+    // ------------------------------------------------------------------------
+    static void buildTree(const std::vector<AABB> &boxes, Tree &tree)
+    {
+        size_t count = boxes.size();
+        tree.nodes.clear();
+        tree.order.resize(count);
+        tree.leafOf.assign(count, NO_NODE);
+        tree.sah = 0.0;
+        if (count == 0)
+            return;
+
+        std::vector<glm::vec3> centers(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            tree.order[i] = i;
+            centers[i] = boxes[i].center();
+        }
+
+        tree.nodes.reserve(2 * (count / MAX_LEAF_SIZE + 1));
+        Node root;
+        root.parent = NO_NODE;
+        root.first = 0;
+        root.count = count;
+        tree.nodes.push_back(root);
+
+        std::vector<size_t> stack;
+        stack.push_back(0);
+        while (!stack.empty())
+        {
+            size_t index = stack.back();
+            stack.pop_back();
+            size_t first = tree.nodes[index].first;
+            size_t n = tree.nodes[index].count;
+
+            AABB bounds, centerBounds;
+            for (size_t i = first; i < first + n; i++)
+            {
+                bounds.grow(boxes[tree.order[i]]);
+                centerBounds.grow(centers[tree.order[i]]);
+            }
+            tree.nodes[index].bounds = bounds;
+
+            size_t mid = first;
+            if (n > MAX_LEAF_SIZE)
+                mid = splitNode(boxes, centers, tree.order, first, n, bounds, centerBounds);
+
+            if (mid == first)
+            {
+                for (size_t i = first; i < first + n; i++)
+                    tree.leafOf[tree.order[i]] = index;
+                tree.sah += nodeWeight(tree.nodes[index]) * bounds.area();
+                continue;
+            }
+
+            size_t left = tree.nodes.size();
+            Node child;
+            child.parent = index;
+            child.first = first;
+            child.count = mid - first;
+            tree.nodes.push_back(child);
+            child.first = mid;
+            child.count = first + n - mid;
+            tree.nodes.push_back(child);
+
+            tree.nodes[index].first = left;
+            tree.nodes[index].count = 0;
+            tree.sah += bounds.area();
+            stack.push_back(left);
+            stack.push_back(left + 1);
+        }
+    }
+
+    // partitions order[first, first + n) and returns where the right half starts,
+    // or first when the node should stay a leaf
+    static size_t splitNode(const std::vector<AABB> &boxes, const std::vector<glm::vec3> &centers,
+                            std::vector<size_t> &order, size_t first, size_t n,
+                            const AABB &bounds, const AABB &centerBounds)
+    {
+        int bestAxis = -1;
+        int bestBin = 0;
+        double bestCost = (double)n * bounds.area();
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float extent = centerBounds.max[axis] - centerBounds.min[axis];
+            if (extent <= 0.0f)
+                continue;
+
+            AABB binBounds[BIN_COUNT];
+            size_t binCounts[BIN_COUNT] = {};
+            float scale = BIN_COUNT / extent;
+            for (size_t i = first; i < first + n; i++)
+            {
+                int bin = std::min(BIN_COUNT - 1, (int)((centers[order[i]][axis] - centerBounds.min[axis]) * scale));
+                binCounts[bin]++;
+                binBounds[bin].grow(boxes[order[i]]);
+            }
+
+            // cost of splitting after every bin: sweep from the right, then from the left
+            double rightCost[BIN_COUNT];
+            AABB right;
+            size_t rightCount = 0;
+            for (int bin = BIN_COUNT - 1; bin > 0; bin--)
+            {
+                right.grow(binBounds[bin]);
+                rightCount += binCounts[bin];
+                rightCost[bin] = (double)rightCount * right.area();
+            }
+            AABB left;
+            size_t leftCount = 0;
+            for (int bin = 0; bin < BIN_COUNT - 1; bin++)
+            {
+                left.grow(binBounds[bin]);
+                leftCount += binCounts[bin];
+                double cost = bounds.area() + (double)leftCount * left.area() + rightCost[bin + 1];
+                if (leftCount > 0 && leftCount < n && cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestBin = bin;
+                }
+            }
+        }
+
+        if (bestAxis < 0)
+        {
+            // splitting doesn't pay off, but leaves are kept small so refits stay cheap
+            if (n <= 4 * MAX_LEAF_SIZE)
+                return first;
+
+            int axis = 0;
+            glm::vec3 extent = centerBounds.max - centerBounds.min;
+            if (extent.y > extent[axis])
+                axis = 1;
+            if (extent.z > extent[axis])
+                axis = 2;
+            size_t mid = first + n / 2;
+            std::nth_element(order.begin() + first, order.begin() + mid, order.begin() + first + n,
+                             [&](size_t a, size_t b) { return centers[a][axis] < centers[b][axis]; });
+            return mid;
+        }
+
+        float scale = BIN_COUNT / (centerBounds.max[bestAxis] - centerBounds.min[bestAxis]);
+        std::vector<size_t>::iterator mid = std::partition(order.begin() + first, order.begin() + first + n, [&](size_t i) {
+            int bin = std::min(BIN_COUNT - 1, (int)((centers[i][bestAxis] - centerBounds.min[bestAxis]) * scale));
+            return bin <= bestBin;
+        });
+        return mid - order.begin();
+    }
+
+    // owns a worker thread
+    BVH(const BVH&);
+    BVH& operator=(const BVH&);
+};
+
+#endif
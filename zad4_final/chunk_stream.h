@@ -0,0 +1,556 @@
+#ifndef CHUNK_STREAM_H
+#define CHUNK_STREAM_H
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+
+#include "learnopengl/filesystem.h"
+#include "learnopengl/gl_owner.h"
+#include "learnopengl/render_queue.h"
+#include "level.h"
+#include "bvh.h"
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include <iostream>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+// Endless levels are cut into chunks of CHUNK_CELLS^3 grid cells, the cells as big as those of the
+// N*N*N cube, so chunk (0, 0, 0) starts at the cube's corner (-1, -1, -1).
+const int CHUNK_CELLS = 8;
+const size_t CHUNK_INSTANCES = CHUNK_CELLS * CHUNK_CELLS * CHUNK_CELLS;
+
+// Level file, written by levelpack and read through FileSystem (so it is mapped, or served from the
+// asset archive); chunks it doesn't have are generated:
+//   header   "LVLS", version, cells per chunk, chunk count, cell size
+//   chunks   LevelFileChunk per chunk
+//   data     per chunk vec3 translations[count], then vec4 rotations[count]
+const uint32_t LEVEL_FILE_VERSION = 1;
+
+struct LevelFileHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t chunkCells;
+    uint32_t chunkCount;
+    float cellSize;
+    uint32_t reserved;
+};
+
+struct LevelFileChunk
+{
+    int32_t x, y, z;
+    uint32_t count;
+    uint64_t offset;
+};
+
+// grid cell -> chunk, rounding towards -infinity
+inline int chunkOfCell(int cell)
+{
+    return cell >= 0 ? cell / CHUNK_CELLS : -((-cell + CHUNK_CELLS - 1) / CHUNK_CELLS);
+}
+
+// seed of a generated chunk: its coordinates hashed into the level's, for instanceRotation
+inline unsigned int generatedChunkSeed(unsigned int seed, const glm::ivec3 &coord)
+{
+    return glsl::hashUint(seed ^ glsl::hashUint((unsigned int)coord.x * 73856093u ^ (unsigned int)coord.y * 19349663u ^
+                                                (unsigned int)coord.z * 83492791u));
+}
+
+// cell i (x fastest) of a generated chunk, chunkSeed from generatedChunkSeed
+inline void generatedCell(unsigned int chunkSeed, const glm::ivec3 &coord, size_t i, float cellSize,
+                          glm::vec3 &translation, glm::vec4 &rotation)
+{
+    int x = coord.x * CHUNK_CELLS + (int)(i % CHUNK_CELLS);
+    int y = coord.y * CHUNK_CELLS + (int)(i / CHUNK_CELLS % CHUNK_CELLS);
+    int z = coord.z * CHUNK_CELLS + (int)(i / (CHUNK_CELLS * CHUNK_CELLS));
+    translation = glm::vec3((x + 0.5f) * cellSize - 1.0f, (y + 0.5f) * cellSize - 1.0f, (z + 0.5f) * cellSize - 1.0f);
+    rotation = instanceRotation(chunkSeed, (unsigned int)i);
+}
+
+// the N*N*N cube of (seed, N) cut into chunks, as the level file for it; false if it can't be written.
+// Cells of the cube are the fixed level's instances (the last one dropped like there); when N isn't a
+// multiple of CHUNK_CELLS the edge chunks reach past the cube, and those cells are filled like a
+// generated chunk's, so the stored chunks are as full as the generated ones next to them
+// ---------------------------------------------------------------------------------------------------------
+inline bool writeLevelFile(const std::string &path, unsigned int seed, unsigned int N)
+{
+    int chunksPerSide = (N + CHUNK_CELLS - 1) / CHUNK_CELLS;
+    size_t instanceCount = (size_t)N * N * N - 1;
+    float cellSize = 2.0f / N;
+    int last = chunkOfCell(N - 1);
+    glm::ivec3 lastChunk(last, last, last);
+
+    std::vector<LevelFileChunk> chunks((size_t)chunksPerSide * chunksPerSide * chunksPerSide);
+    uint64_t offset = sizeof(LevelFileHeader) + chunks.size() * sizeof(LevelFileChunk);
+    for (size_t i = 0; i < chunks.size(); i++)
+    {
+        chunks[i].x = i % chunksPerSide;
+        chunks[i].y = (i / chunksPerSide) % chunksPerSide;
+        chunks[i].z = i / ((size_t)chunksPerSide * chunksPerSide);
+        // every chunk is full but the one with the dropped instance
+        chunks[i].count = CHUNK_INSTANCES - (glm::ivec3(chunks[i].x, chunks[i].y, chunks[i].z) == lastChunk ? 1 : 0);
+        chunks[i].offset = offset;
+        offset += chunks[i].count * (sizeof(glm::vec3) + sizeof(glm::vec4));
+    }
+
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file == nullptr)
+        return false;
+    LevelFileHeader header;
+    std::memcpy(header.magic, "LVLS", 4);
+    header.version = LEVEL_FILE_VERSION;
+    header.chunkCells = CHUNK_CELLS;
+    header.chunkCount = chunks.size();
+    header.cellSize = cellSize;
+    header.reserved = 0;
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(chunks.data(), sizeof(LevelFileChunk), chunks.size(), file) == chunks.size();
+    std::vector<glm::vec3> translations;
+    std::vector<glm::vec4> rotations;
+    for (size_t i = 0; ok && i < chunks.size(); i++)
+    {
+        glm::ivec3 coord(chunks[i].x, chunks[i].y, chunks[i].z);
+        unsigned int chunkSeed = generatedChunkSeed(seed, coord);
+        translations.clear();
+        rotations.clear();
+        for (size_t cell = 0; cell < CHUNK_INSTANCES; cell++)
+        {
+            size_t x = coord.x * CHUNK_CELLS + cell % CHUNK_CELLS;
+            size_t y = coord.y * CHUNK_CELLS + cell / CHUNK_CELLS % CHUNK_CELLS;
+            size_t z = coord.z * CHUNK_CELLS + cell / (CHUNK_CELLS * CHUNK_CELLS);
+            if (x < N && y < N && z < N)
+            {
+                size_t index = (z * N + y) * N + x;
+                if (index == instanceCount)
+                    continue;
+                translations.push_back(instanceTranslation((unsigned int)index, N));
+                rotations.push_back(instanceRotation(seed, (unsigned int)index));
+            }
+            else
+            {
+                translations.push_back(glm::vec3());
+                rotations.push_back(glm::vec4());
+                generatedCell(chunkSeed, coord, cell, cellSize, translations.back(), rotations.back());
+            }
+        }
+        ok = fwrite(translations.data(), sizeof(glm::vec3), translations.size(), file) == translations.size() &&
+             fwrite(rotations.data(), sizeof(glm::vec4), rotations.size(), file) == rotations.size();
+    }
+    ok = fclose(file) == 0 && ok;
+    if (!ok)
+        remove(path.c_str());
+    return ok;
+}
+
+// Streams an endless level around a moving point. Chunks within `radius` chunks of it are generated
+// (or read from the level file) on a worker thread, together with their collision triangles and a
+// BVH over them. update(), once a frame on the GL thread, uploads finished chunks into a fixed pool
+// of GPU slots until its time budget is spent; when every slot is taken, the least recently wanted
+// chunk is evicted. The pool, the chunks waiting for it and the requests are all bounded by the
+// number of chunks within the radius, so memory stays the same however far the player goes.
+class ChunkStreamer : private GLOwner
+{
+public:
+    // meshVBO holds the triangle like for InstancePages; levelFile may be empty
+    ChunkStreamer(unsigned int seed, unsigned int N, int radius, const glm::mat3 &baseTriangle, unsigned int meshVBO,
+                  const std::string &levelFile)
+        : seed(seed), cellSize(2.0f / N), radius(radius), baseTriangle(baseTriangle), reach(0.0f), frame(0),
+          stopping(false), translationVBO(0), rotationVBO(0), uploads(0), evictions(0), worstUpdate(0.0)
+    {
+        for (int i = 0; i < 3; i++)
+            reach = std::max(reach, glm::length(baseTriangle[i]));
+        openLevelFile(levelFile);
+
+        // every chunk within the radius has a slot, plus a shell of them for the chunks just left behind
+        int side = 2 * radius + 1;
+        slotCount = (size_t)side * side * side + (size_t)6 * side * side;
+        createSlots(meshVBO);
+        worker = std::thread([this]() { work(); });
+    }
+
+    ~ChunkStreamer()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        worker.join();
+
+        if (!glReleasable())
+            return;
+        for (GLuint vao : slotVAOs)
+            glDeleteVertexArrays(1, &vao);
+        glDeleteBuffers(1, &translationVBO);
+        glDeleteBuffers(1, &rotationVBO);
+    }
+
+    // request the chunks around center, drop the ones nobody wants any more and upload finished ones
+    // until budget seconds have passed (at least one); GL thread only
+    // ------------------------------------------------------------------------
+    void update(glm::vec3 center, double budget)
+    {
+        double start = glfwGetTime();
+        frame++;
+
+        // wanted chunks, nearest first, so they are generated first
+        glm::ivec3 middle = chunkAt(center);
+        std::vector<glm::ivec3> wanted;
+        for (int z = -radius; z <= radius; z++)
+            for (int y = -radius; y <= radius; y++)
+                for (int x = -radius; x <= radius; x++)
+                    wanted.push_back(glm::ivec3(middle.x + x, middle.y + y, middle.z + z));
+        std::sort(wanted.begin(), wanted.end(), [&](const glm::ivec3 &a, const glm::ivec3 &b) {
+            return distance2(a, middle) < distance2(b, middle);
+        });
+
+        std::vector<Chunk*> requested;
+        for (const glm::ivec3 &coord : wanted)
+        {
+            std::unordered_map<uint64_t, std::unique_ptr<Chunk> >::iterator it = chunks.find(key(coord));
+            if (it == chunks.end())
+            {
+                Chunk* chunk = new Chunk();
+                chunk->coord = coord;
+                chunk->state = REQUESTED;
+                chunk->slot = NO_SLOT;
+                it = chunks.emplace(key(coord), std::unique_ptr<Chunk>(chunk)).first;
+                requested.push_back(chunk);
+            }
+            it->second->lastWanted = frame;
+        }
+
+        std::vector<Chunk*> finished;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            // requests the worker hasn't started are dropped once they aren't wanted
+            std::deque<Chunk*> kept;
+            for (Chunk* chunk : requests)
+            {
+                if (chunk->lastWanted == frame)
+                    kept.push_back(chunk);
+                else
+                    chunks.erase(key(chunk->coord));
+            }
+            kept.insert(kept.end(), requested.begin(), requested.end());
+            requests.swap(kept);
+            finished.assign(loaded.begin(), loaded.end());
+            loaded.clear();
+        }
+        if (!requested.empty())
+            wake.notify_one();
+        waiting.insert(waiting.end(), finished.begin(), finished.end());
+
+        // upload in the order they were finished; the ones left behind meanwhile are dropped
+        std::deque<Chunk*> stillWanted;
+        for (Chunk* chunk : waiting)
+        {
+            if (chunk->lastWanted == frame)
+                stillWanted.push_back(chunk);
+            else
+                chunks.erase(key(chunk->coord));
+        }
+        waiting.swap(stillWanted);
+        double deadline = start + budget;
+        while (!waiting.empty())
+        {
+            upload(*waiting.front());
+            waiting.pop_front();
+            if (glfwGetTime() >= deadline)
+                break;
+        }
+
+        worstUpdate = std::max(worstUpdate, glfwGetTime() - start);
+    }
+
+    // whether a sphere touches a streamed triangle, or reaches into a chunk that isn't resident yet
+    // (so it can't pass through geometry that hasn't arrived)
+    // ------------------------------------------------------------------------
+    bool collides(glm::vec3 center, float sphereRadius)
+    {
+        glm::ivec3 lo = chunkAt(center - glm::vec3(sphereRadius + reach));
+        glm::ivec3 hi = chunkAt(center + glm::vec3(sphereRadius + reach));
+        for (int z = lo.z; z <= hi.z; z++)
+            for (int y = lo.y; y <= hi.y; y++)
+                for (int x = lo.x; x <= hi.x; x++)
+                {
+                    std::unordered_map<uint64_t, std::unique_ptr<Chunk> >::iterator it = chunks.find(key(glm::ivec3(x, y, z)));
+                    if (it == chunks.end() || it->second->state != RESIDENT)
+                        return true;
+                    Chunk &chunk = *it->second;
+                    chunk.bvh->query(center, sphereRadius, candidates);
+                    for (size_t index : candidates)
+                    {
+                        glm::vec3 closestPoint = chunk.triangles[index].ClosestPointTo(center);
+                        if (glm::distance2(closestPoint, center) < sphereRadius * sphereRadius)
+                            return true;
+                    }
+                }
+        return false;
+    }
+
+    // one instanced draw per resident chunk
+    // ------------------------------------------------------------------------
+    void record(RenderQueue &queue, unsigned int view, unsigned int shaderID) const
+    {
+        for (size_t slot = 0; slot < slotCount; slot++)
+            if (slotChunks[slot] != nullptr && slotChunks[slot]->count > 0)
+                queue.drawArraysInstanced(view, 0, shaderID, slotVAOs[slot], GL_TRIANGLES, 3, slotChunks[slot]->count);
+    }
+
+    size_t residentChunks() const
+    {
+        return slotCount - freeSlots.size();
+    }
+
+    void printStats() const
+    {
+        std::cout << "chunk streaming: " << uploads << " chunks uploaded, " << evictions << " evicted, "
+                  << residentChunks() << " of " << slotCount << " slots in use ("
+                  << slotCount * CHUNK_INSTANCES * (sizeof(glm::vec3) + sizeof(glm::vec4)) / 1024 << "KB), worst update "
+                  << worstUpdate * 1000.0 << "ms" << std::endl;
+    }
+
+private:
+    enum State { REQUESTED, LOADED, RESIDENT };
+    static constexpr size_t NO_SLOT = ~(size_t)0;
+
+    struct Chunk
+    {
+        glm::ivec3 coord;
+        std::atomic<int> state;
+        // frame of the last update() that wanted the chunk, GL thread only
+        unsigned long long lastWanted;
+        size_t slot;
+        size_t count;
+        // instance data until it is uploaded, collision data while the chunk is resident
+        std::vector<glm::vec3> translations;
+        std::vector<glm::vec4> rotations;
+        std::vector<Triangle> triangles;
+        std::unique_ptr<BVH> bvh;
+    };
+
+    unsigned int seed;
+    float cellSize;
+    int radius;
+    glm::mat3 baseTriangle;
+    float reach;
+    unsigned long long frame;
+
+    // chunks are only touched by the GL thread, the worker sees them through requests and loaded
+    std::unordered_map<uint64_t, std::unique_ptr<Chunk> > chunks;
+    std::deque<Chunk*> requests;
+    std::deque<Chunk*> loaded;
+    std::deque<Chunk*> waiting;
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping;
+
+    // the level file's chunks, by key, and the mapped file they point into
+    Asset levelFile;
+    std::unordered_map<uint64_t, const LevelFileChunk*> fileChunks;
+
+    // GPU pool: slot i is instances [i * CHUNK_INSTANCES, (i + 1) * CHUNK_INSTANCES) of both buffers
+    size_t slotCount;
+    GLuint translationVBO, rotationVBO;
+    std::vector<GLuint> slotVAOs;
+    std::vector<Chunk*> slotChunks;
+    std::vector<size_t> freeSlots;
+    std::vector<size_t> candidates;
+
+    unsigned long long uploads, evictions;
+    double worstUpdate;
+
+    // 21 bits per coordinate, a million chunks in every direction
+    static uint64_t key(const glm::ivec3 &coord)
+    {
+        return ((uint64_t)(coord.x & 0x1fffff) << 42) | ((uint64_t)(coord.y & 0x1fffff) << 21) | (uint64_t)(coord.z & 0x1fffff);
+    }
+
+    static int distance2(const glm::ivec3 &a, const glm::ivec3 &b)
+    {
+        return (a.x - b.x) * (a.x - b.x) + (a.y - b.y) * (a.y - b.y) + (a.z - b.z) * (a.z - b.z);
+    }
+
+    glm::ivec3 chunkAt(glm::vec3 p) const
+    {
+        return glm::ivec3(chunkOfCell((int)std::floor((p.x + 1.0f) / cellSize)),
+                          chunkOfCell((int)std::floor((p.y + 1.0f) / cellSize)),
+                          chunkOfCell((int)std::floor((p.z + 1.0f) / cellSize)));
+    }
+
+    void openLevelFile(const std::string &path)
+    {
+        if (path.empty())
+            return;
+        levelFile = FileSystem::open(path);
+        const char* bytes = levelFile.data();
+        size_t size = levelFile.size();
+        LevelFileHeader header;
+        bool ok = levelFile.valid() && size >= sizeof(header);
+        if (ok)
+            std::memcpy(&header, bytes, sizeof(header));
+        ok = ok && std::memcmp(header.magic, "LVLS", 4) == 0 && header.version == LEVEL_FILE_VERSION &&
+             header.chunkCells == (uint32_t)CHUNK_CELLS && header.cellSize > 0.0f &&
+             sizeof(header) + (size_t)header.chunkCount * sizeof(LevelFileChunk) <= size;
+        for (uint32_t i = 0; ok && i < header.chunkCount; i++)
+        {
+            const LevelFileChunk* chunk = (const LevelFileChunk*)(bytes + sizeof(header)) + i;
+            ok = chunk->count <= CHUNK_INSTANCES && chunk->offset <= size &&
+                 chunk->count * (sizeof(glm::vec3) + sizeof(glm::vec4)) <= size - chunk->offset;
+            if (ok)
+                fileChunks[key(glm::ivec3(chunk->x, chunk->y, chunk->z))] = chunk;
+        }
+        if (!ok)
+        {
+            std::cout << path << ": not a level file, the whole level is generated" << std::endl;
+            fileChunks.clear();
+            levelFile = Asset();
+            return;
+        }
+        // the file decides how dense the level is
+        cellSize = header.cellSize;
+        std::cout << path << ": " << fileChunks.size() << " chunks" << std::endl;
+    }
+
+    void createSlots(unsigned int meshVBO)
+    {
+        GLsizeiptr instances = (GLsizeiptr)(slotCount * CHUNK_INSTANCES);
+        glGenBuffers(1, &translationVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, translationVBO);
+        glBufferData(GL_ARRAY_BUFFER, instances * sizeof(glm::vec3), nullptr, GL_DYNAMIC_DRAW);
+        glGenBuffers(1, &rotationVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, rotationVBO);
+        glBufferData(GL_ARRAY_BUFFER, instances * sizeof(glm::vec4), nullptr, GL_DYNAMIC_DRAW);
+
+        // a VAO per slot points the instance attributes at the slot (a 3.3 context has no base instance)
+        slotVAOs.resize(slotCount);
+        slotChunks.assign(slotCount, nullptr);
+        for (size_t slot = 0; slot < slotCount; slot++)
+        {
+            glGenVertexArrays(1, &slotVAOs[slot]);
+            glBindVertexArray(slotVAOs[slot]);
+            glBindBuffer(GL_ARRAY_BUFFER, meshVBO);
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
+            glEnableVertexAttribArray(1);
+            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
+
+            glEnableVertexAttribArray(2);
+            glBindBuffer(GL_ARRAY_BUFFER, translationVBO);
+            glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)(slot * CHUNK_INSTANCES * sizeof(glm::vec3)));
+            glVertexAttribDivisor(2, 1);
+            glEnableVertexAttribArray(3);
+            glBindBuffer(GL_ARRAY_BUFFER, rotationVBO);
+            glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)(slot * CHUNK_INSTANCES * sizeof(glm::vec4)));
+            glVertexAttribDivisor(3, 1);
+            freeSlots.push_back(slotCount - 1 - slot);
+        }
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // into a free slot, or the one of the chunk wanted longest ago
+    void upload(Chunk &chunk)
+    {
+        if (freeSlots.empty())
+        {
+            size_t victim = 0;
+            for (size_t slot = 1; slot < slotCount; slot++)
+                if (slotChunks[slot]->lastWanted < slotChunks[victim]->lastWanted)
+                    victim = slot;
+            chunks.erase(key(slotChunks[victim]->coord));
+            slotChunks[victim] = nullptr;
+            freeSlots.push_back(victim);
+            evictions++;
+        }
+        size_t slot = freeSlots.back();
+        freeSlots.pop_back();
+
+        glBindBuffer(GL_ARRAY_BUFFER, translationVBO);
+        glBufferSubData(GL_ARRAY_BUFFER, slot * CHUNK_INSTANCES * sizeof(glm::vec3), chunk.count * sizeof(glm::vec3), chunk.translations.data());
+        glBindBuffer(GL_ARRAY_BUFFER, rotationVBO);
+        glBufferSubData(GL_ARRAY_BUFFER, slot * CHUNK_INSTANCES * sizeof(glm::vec4), chunk.count * sizeof(glm::vec4), chunk.rotations.data());
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        // the GPU has its copy now
+        std::vector<glm::vec3>().swap(chunk.translations);
+        std::vector<glm::vec4>().swap(chunk.rotations);
+        chunk.slot = slot;
+        chunk.state = RESIDENT;
+        slotChunks[slot] = &chunk;
+        uploads++;
+    }
+
+    void work()
+    {
+        for (;;)
+        {
+            Chunk* chunk;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this]() { return stopping || !requests.empty(); });
+                if (stopping)
+                    return;
+                chunk = requests.front();
+                requests.pop_front();
+            }
+
+            build(*chunk);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            chunk->state = LOADED;
+            loaded.push_back(chunk);
+        }
+    }
+
+    // instances from the level file or the generator, then their triangles and BVH; worker only
+    void build(Chunk &chunk)
+    {
+        std::unordered_map<uint64_t, const LevelFileChunk*>::const_iterator stored = fileChunks.find(key(chunk.coord));
+        if (stored != fileChunks.end())
+        {
+            const LevelFileChunk &record = *stored->second;
+            const glm::vec3* translations = (const glm::vec3*)(levelFile.data() + record.offset);
+            const glm::vec4* rotations = (const glm::vec4*)(translations + record.count);
+            chunk.translations.assign(translations, translations + record.count);
+            chunk.rotations.assign(rotations, rotations + record.count);
+        }
+        else
+        {
+            // every chunk hashes its coordinates into its own seed for instanceRotation
+            unsigned int chunkSeed = generatedChunkSeed(seed, chunk.coord);
+            chunk.translations.resize(CHUNK_INSTANCES);
+            chunk.rotations.resize(CHUNK_INSTANCES);
+            for (size_t i = 0; i < CHUNK_INSTANCES; i++)
+                generatedCell(chunkSeed, chunk.coord, i, cellSize, chunk.translations[i], chunk.rotations[i]);
+        }
+        chunk.count = chunk.translations.size();
+
+        std::vector<AABB> boxes;
+        boxes.reserve(chunk.count);
+        chunk.triangles.reserve(chunk.count);
+        for (size_t i = 0; i < chunk.count; i++)
+        {
+            chunk.triangles.push_back(instanceTriangle(baseTriangle, chunk.translations[i], chunk.rotations[i]));
+            boxes.push_back(triangleBounds(chunk.triangles.back()));
+        }
+        chunk.bvh.reset(new BVH());
+        chunk.bvh->build(boxes);
+    }
+};
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef COLLISION_H
+#define COLLISION_H
+
+#include <glm/glm.hpp>
+#include <glm/gtx/norm.hpp>
+
+struct Edge3
+{
+
+    glm::vec3 A;
+    glm::vec3 B;
+    glm::vec3 Delta;
+
+    float LengthSquared;
+
+    Edge3(){};
+
+    Edge3(glm::vec3 a, glm::vec3 b)
+    {
+        A = a;
+        B = b;
+        Delta = b - a;
+        LengthSquared = glm::length2(Delta);
+    }
+
+    glm::vec3 PointAt(float t)
+    {
+        return A + t * Delta;
+    }
+
+    float Project(glm::vec3 p)
+    {
+        return glm::dot(p-A, Delta) / LengthSquared;
+    }
+};
+
+struct Plane
+{
+    glm::vec3 Point;
+    glm::vec3 Direction;
+
+    Plane(){};
+
+    Plane(glm::vec3 point, glm::vec3 direction )
+    {
+        Point = point;
+        Direction = direction;
+    }
+
+    bool IsAbove(glm::vec3 q)
+    {
+        return glm::dot(Direction, q - Point) > 0;
+    }
+
+    glm::vec3 Project(glm::vec3 p)
+    {
+        glm::vec3 normalizedDirecion = glm::normalize(Direction);
+        return p - (glm::dot(p, normalizedDirecion) - glm::dot(Point, normalizedDirecion)) * normalizedDirecion;
+    }
+};
+
+struct Triangle
+{
+    Edge3 EdgeAb;
+    Edge3 EdgeBc;
+    Edge3 EdgeCa;
+
+    glm::vec3 A;
+    glm::vec3 B;
+    glm::vec3 C;
+
+    glm::vec3 TriNorm;
+
+    Plane TriPlane;
+    Plane PlaneAb;
+    Plane PlaneBc;
+    Plane PlaneCa;
+
+    Triangle(glm::vec3 a, glm::vec3 b, glm::vec3 c)
+    {
+        EdgeAb = Edge3( a, b );
+        EdgeBc = Edge3( b, c );
+        EdgeCa = Edge3( c, a );
+        TriNorm = glm::cross(a - b, a - c);
+
+        A = a;
+        B = b;
+        C = c;
+
+        PlaneAb = Plane(a, glm::cross(TriNorm, EdgeAb.Delta ));
+        PlaneBc = Plane(b, glm::cross(TriNorm, EdgeBc.Delta ));
+        PlaneCa = Plane(c, glm::cross(TriNorm, EdgeCa.Delta ));
+
+        TriPlane = Plane(A, TriNorm);
+    }
+
+    glm::vec3 ClosestPointTo(glm::vec3 p)
+    {
+        float uab = EdgeAb.Project( p );
+        float uca = EdgeCa.Project( p );
+
+        if (uca > 1 && uab < 0)
+            return A;
+
+        float ubc = EdgeBc.Project( p );
+
+        if (uab > 1 && ubc < 0)
+            return B;
+
+        if (ubc > 1 && uca < 0)
+            return C;
+
+        if (uab >= 0 && uab <= 1 && !PlaneAb.IsAbove( p ))
+            return EdgeAb.PointAt( uab );
+
+        if (ubc >= 0 && ubc <= 1 && !PlaneBc.IsAbove( p ))
+            return EdgeBc.PointAt( ubc );
+
+        if (uca >= 0 && uca <= 1 && !PlaneCa.IsAbove( p ))
+            return EdgeCa.PointAt( uca );
+
+        return TriPlane.Project( p );
+    }
+};
+
+#endif
@@ -4,8 +4,11 @@ layout (location = 1) in vec3 aColor;
 
 out vec3 fColor;
 
-uniform mat4 projection;
-uniform mat4 view;
+layout (std140) uniform Matrices
+{
+    mat4 projection;
+    mat4 view;
+};
 
 void main()
 {
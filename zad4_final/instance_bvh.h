@@ -0,0 +1,263 @@
+#ifndef INSTANCE_BVH_H
+#define INSTANCE_BVH_H
+
+#include <glm/glm.hpp>
+
+#include "collision.h"
+#include "bvh.h"
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <utility>
+#include <cmath>
+#include <cfloat>
+
+// Triangles of one mesh in its own space with a BVH over them, built once and shared by every
+// instance of the mesh.
+struct CollisionMesh
+{
+    // 3 per triangle
+    std::vector<glm::vec3> vertices;
+    BVH bvh;
+    AABB bounds;
+
+    CollisionMesh(std::vector<glm::vec3> triangleVertices) : vertices(std::move(triangleVertices))
+    {
+        std::vector<AABB> boxes(vertices.size() / 3);
+        for (size_t i = 0; i < boxes.size(); i++)
+        {
+            boxes[i].grow(vertices[3 * i]);
+            boxes[i].grow(vertices[3 * i + 1]);
+            boxes[i].grow(vertices[3 * i + 2]);
+            bounds.grow(boxes[i]);
+        }
+        bvh.build(boxes);
+    }
+
+    Triangle triangle(size_t index) const
+    {
+        return Triangle(vertices[3 * index], vertices[3 * index + 1], vertices[3 * index + 2]);
+    }
+};
+
+// Two-level collision structure for instanced meshes: a bottom-level BVH per unique mesh
+// (CollisionMesh) and a top-level BVH over the instances' world bounds. An instance is only a
+// mesh index and a transform, so memory grows with the unique meshes, not with the instance count.
+// Queries find the instances in the top level and run in each one's own space against the shared
+// mesh. Transforms are rotations, uniform scales and translations, so a sphere stays a sphere in
+// instance space (with its radius divided by the scale) and a segment keeps its parameter t.
+class InstanceBVH
+{
+public:
+    struct Instance
+    {
+        size_t mesh;
+        glm::mat4 toWorld;
+        glm::mat4 toLocal;
+        float scale;
+    };
+
+    // a triangle within reach of a sphere query
+    struct Contact
+    {
+        size_t instance;
+        size_t triangle;
+        // on the triangle, in world space
+        glm::vec3 closestPoint;
+    };
+
+    // the first triangle a ray query hits
+    struct Hit
+    {
+        size_t instance;
+        size_t triangle;
+        float t;
+    };
+
+    std::vector<Instance> instances;
+
+    InstanceBVH() : topDirty(false), topMoved(false)
+    {
+    }
+
+    // returns the index to instantiate the mesh with; pass the triangles with std::move to hand them over
+    // ------------------------------------------------------------------------
+    size_t addMesh(std::vector<glm::vec3> triangleVertices)
+    {
+        meshes.push_back(std::unique_ptr<CollisionMesh>(new CollisionMesh(std::move(triangleVertices))));
+        return meshes.size() - 1;
+    }
+
+    // the top level is rebuilt with the next query
+    // ------------------------------------------------------------------------
+    size_t addInstance(size_t mesh, const glm::mat4 &transform)
+    {
+        Instance instance;
+        instance.mesh = mesh;
+        setTransform(instance, transform);
+        instances.push_back(instance);
+        topDirty = true;
+        return instances.size() - 1;
+    }
+
+    // move an instance; refit into the top level instead of rebuilding it
+    // ------------------------------------------------------------------------
+    void moveInstance(size_t index, const glm::mat4 &transform)
+    {
+        setTransform(instances[index], transform);
+        if (!topDirty)
+        {
+            top.update(index, worldBounds(instances[index]));
+            topMoved = true;
+        }
+    }
+
+    size_t meshCount() const
+    {
+        return meshes.size();
+    }
+
+    const CollisionMesh &mesh(size_t index) const
+    {
+        return *meshes[index];
+    }
+
+    // every triangle within radius of center, leaving out the instances in ignored
+    // ------------------------------------------------------------------------
+    void query(glm::vec3 center, float radius, std::vector<Contact> &result, const std::vector<size_t> &ignored)
+    {
+        result.clear();
+        updateTop();
+        top.query(center, radius, instanceCandidates);
+        for (size_t index : instanceCandidates)
+        {
+            if (std::find(ignored.begin(), ignored.end(), index) != ignored.end())
+                continue;
+            const Instance &instance = instances[index];
+            const CollisionMesh &collisionMesh = *meshes[instance.mesh];
+            glm::vec3 localCenter = glm::vec3(instance.toLocal * glm::vec4(center, 1.0f));
+            float localRadius = radius / instance.scale;
+            collisionMesh.bvh.query(localCenter, localRadius, triangleCandidates);
+            for (size_t triangleIndex : triangleCandidates)
+            {
+                glm::vec3 closest = collisionMesh.triangle(triangleIndex).ClosestPointTo(localCenter);
+                if (glm::distance2(closest, localCenter) > localRadius * localRadius)
+                    continue;
+                Contact contact = { index, triangleIndex, glm::vec3(instance.toWorld * glm::vec4(closest, 1.0f)) };
+                result.push_back(contact);
+            }
+        }
+    }
+
+    // nearest triangle hit by origin + t * direction, t in [0, maxT], leaving out the instances in
+    // ignored; false if there is none
+    // ------------------------------------------------------------------------
+    bool raycast(glm::vec3 origin, glm::vec3 direction, float maxT, Hit &hit, const std::vector<size_t> &ignored)
+    {
+        hit.t = maxT;
+        if (glm::dot(direction, direction) == 0.0f)
+            return false;
+        updateTop();
+        bool found = false;
+        top.raycast(origin, direction, maxT, instanceCandidates);
+        for (size_t index : instanceCandidates)
+        {
+            if (std::find(ignored.begin(), ignored.end(), index) != ignored.end())
+                continue;
+            const Instance &instance = instances[index];
+            const CollisionMesh &collisionMesh = *meshes[instance.mesh];
+            // the direction isn't normalized in instance space, so t means the same point in both
+            glm::vec3 localOrigin = glm::vec3(instance.toLocal * glm::vec4(origin, 1.0f));
+            glm::vec3 localDirection = glm::mat3(instance.toLocal) * direction;
+            collisionMesh.bvh.raycast(localOrigin, localDirection, hit.t, triangleCandidates);
+            for (size_t triangleIndex : triangleCandidates)
+            {
+                float t;
+                if (intersectTriangle(localOrigin, localDirection, &collisionMesh.vertices[3 * triangleIndex], t) && t <= hit.t)
+                {
+                    hit.instance = index;
+                    hit.triangle = triangleIndex;
+                    hit.t = t;
+                    found = true;
+                }
+            }
+        }
+        return found;
+    }
+
+private:
+    std::vector<std::unique_ptr<CollisionMesh> > meshes;
+    BVH top;
+    bool topDirty;
+    // an instance moved since the last refit
+    bool topMoved;
+    std::vector<size_t> instanceCandidates;
+    std::vector<size_t> triangleCandidates;
+
+    static void setTransform(Instance &instance, const glm::mat4 &transform)
+    {
+        instance.toWorld = transform;
+        instance.toLocal = glm::inverse(transform);
+        instance.scale = glm::length(glm::vec3(transform[0]));
+    }
+
+    // the mesh's box transformed, grown by all eight corners
+    AABB worldBounds(const Instance &instance) const
+    {
+        const AABB &local = meshes[instance.mesh]->bounds;
+        AABB bounds;
+        if (local.empty())
+            return bounds;
+        for (int corner = 0; corner < 8; corner++)
+        {
+            glm::vec3 p((corner & 1) ? local.max.x : local.min.x,
+                        (corner & 2) ? local.max.y : local.min.y,
+                        (corner & 4) ? local.max.z : local.min.z);
+            bounds.grow(glm::vec3(instance.toWorld * glm::vec4(p, 1.0f)));
+        }
+        return bounds;
+    }
+
+    void updateTop()
+    {
+        if (topDirty)
+        {
+            std::vector<AABB> boxes(instances.size());
+            for (size_t i = 0; i < instances.size(); i++)
+                boxes[i] = worldBounds(instances[i]);
+            top.build(boxes);
+            topDirty = false;
+            topMoved = false;
+        }
+        else if (topMoved || top.rebuildPending())
+        {
+            top.refit();
+            topMoved = false;
+        }
+    }
+
+    // Moller-Trumbore, both sides of the triangle
+    static bool intersectTriangle(glm::vec3 origin, glm::vec3 direction, const glm::vec3* triangle, float &t)
+    {
+        glm::vec3 ab = triangle[1] - triangle[0];
+        glm::vec3 ac = triangle[2] - triangle[0];
+        glm::vec3 p = glm::cross(direction, ac);
+        float determinant = glm::dot(ab, p);
+        if (std::fabs(determinant) < 1e-12f)
+            return false;
+        float inverse = 1.0f / determinant;
+        glm::vec3 s = origin - triangle[0];
+        float u = glm::dot(s, p) * inverse;
+        if (u < 0.0f || u > 1.0f)
+            return false;
+        glm::vec3 q = glm::cross(s, ab);
+        float v = glm::dot(direction, q) * inverse;
+        if (v < 0.0f || u + v > 1.0f)
+            return false;
+        t = glm::dot(ac, q) * inverse;
+        return t >= 0.0f;
+    }
+};
+
+#endif
@@ -0,0 +1,192 @@
+#ifndef INSTANCE_PAGES_H
+#define INSTANCE_PAGES_H
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+
+#include "learnopengl/gl_owner.h"
+
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+
+// Per-instance translations and rotations of the triangle field, split across fixed-size pages.
+// Every page has its own translation and rotation buffer and a VAO that combines them with the
+// triangle mesh, so no single buffer grows past a driver limit and every size is computed in
+// size_t. Each page is drawn with its own instanced draw (the page's VAO plays the role of a
+// base instance, which a 3.3 core context does not have). For vertex pulling every page can also
+// expose its buffers as buffer textures.
+// Pages are uploaded with appendBuffers, from the drawing context or from a second one that shares
+// objects with it; VAOs aren't shared between contexts, so the pages get theirs from
+// createVertexArrays() in the drawing context.
+class InstancePages : private GLOwner
+{
+public:
+    struct Page
+    {
+        unsigned int VAO;
+        unsigned int translationVBO;
+        unsigned int rotationVBO;
+        // instance index of every slot (SceneStore::indices), read by the level compute shaders
+        unsigned int indexVBO;
+        // GL_R32F view of the translations and GL_RGBA32F view of the rotations, 0 until enabled
+        unsigned int translationTexture;
+        unsigned int rotationTexture;
+        size_t count;
+    };
+
+    std::vector<Page> pages;
+
+    // meshVBO holds the triangle: position and color, 6 floats per vertex
+    InstancePages(unsigned int meshVBO, size_t instancesPerPage)
+        : meshVBO(meshVBO), pageSize(instancesPerPage), total(0), bufferTextures(false)
+    {
+    }
+
+    ~InstancePages()
+    {
+        if (glReleasable())
+            release();
+    }
+
+    size_t instancesPerPage() const
+    {
+        return pageSize;
+    }
+
+    size_t instanceCount() const
+    {
+        return total;
+    }
+
+    // upload one page worth of instances (count <= instancesPerPage()) without its VAO, from any
+    // context that shares objects with the drawing one
+    // ------------------------------------------------------------------------
+    void appendBuffers(const glm::vec3* translations, const glm::vec4* rotations, const unsigned int* indices, size_t count)
+    {
+        if (count == 0)
+            return;
+
+        Page page;
+        page.count = count;
+        page.VAO = 0;
+        page.translationTexture = 0;
+        page.rotationTexture = 0;
+
+        glGenBuffers(1, &page.translationVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, page.translationVBO);
+        glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(sizeof(glm::vec3) * count), translations, GL_STATIC_DRAW);
+
+        glGenBuffers(1, &page.rotationVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, page.rotationVBO);
+        glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(sizeof(glm::vec4) * count), rotations, GL_STATIC_DRAW);
+
+        glGenBuffers(1, &page.indexVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, page.indexVBO);
+        glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(sizeof(unsigned int) * count), indices, GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        pages.push_back(page);
+        total += count;
+    }
+
+    // VAOs (and buffer textures, if enabled) for the pages that don't have them yet; drawing context only
+    // ------------------------------------------------------------------------
+    void createVertexArrays()
+    {
+        for (Page &page : pages)
+            if (page.VAO == 0)
+                createVertexArray(page);
+    }
+
+    // exchange the instances with another level's, the settings (page size, buffer textures) stay
+    // ------------------------------------------------------------------------
+    void swapPages(InstancePages &other)
+    {
+        pages.swap(other.pages);
+        std::swap(total, other.total);
+    }
+
+    // give every page, present and future, buffer textures over its instance data
+    // ------------------------------------------------------------------------
+    void enableBufferTextures()
+    {
+        bufferTextures = true;
+        for (Page &page : pages)
+            if (page.translationTexture == 0)
+                createBufferTextures(page);
+    }
+
+    size_t bytes() const
+    {
+        return total * (sizeof(glm::vec3) + sizeof(glm::vec4) + sizeof(unsigned int));
+    }
+
+    void release()
+    {
+        for (Page &page : pages)
+        {
+            glDeleteVertexArrays(1, &page.VAO);
+            glDeleteBuffers(1, &page.translationVBO);
+            glDeleteBuffers(1, &page.rotationVBO);
+            glDeleteBuffers(1, &page.indexVBO);
+            if (page.translationTexture != 0)
+            {
+                glDeleteTextures(1, &page.translationTexture);
+                glDeleteTextures(1, &page.rotationTexture);
+            }
+        }
+        pages.clear();
+        total = 0;
+    }
+
+private:
+    unsigned int meshVBO;
+    size_t pageSize;
+    size_t total;
+    bool bufferTextures;
+
+    void createVertexArray(Page &page)
+    {
+        glGenVertexArrays(1, &page.VAO);
+        glBindVertexArray(page.VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, meshVBO);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
+
+        // instance data comes from the page's own buffers
+        glEnableVertexAttribArray(2);
+        glBindBuffer(GL_ARRAY_BUFFER, page.translationVBO);
+        glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+        glVertexAttribDivisor(2, 1);
+
+        glEnableVertexAttribArray(3);
+        glBindBuffer(GL_ARRAY_BUFFER, page.rotationVBO);
+        glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)0);
+        glVertexAttribDivisor(3, 1);
+
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        if (bufferTextures && page.translationTexture == 0)
+            createBufferTextures(page);
+    }
+
+    // the textures only alias the page's buffers, they don't copy anything
+    void createBufferTextures(Page &page)
+    {
+        glGenTextures(1, &page.translationTexture);
+        glBindTexture(GL_TEXTURE_BUFFER, page.translationTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_R32F, page.translationVBO);
+
+        glGenTextures(1, &page.rotationTexture);
+        glBindTexture(GL_TEXTURE_BUFFER, page.rotationTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, page.rotationVBO);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+    }
+};
+
+#endif
@@ -5,27 +5,54 @@
 
 #include "learnopengl/shader.h"
 #include "learnopengl/camera.h"
+#include "learnopengl/render_queue.h"
+#include "learnopengl/stream_buffer.h"
+#include "learnopengl/mesh_optimizer.h"
+#define STB_IMAGE_IMPLEMENTATION
+#include "learnopengl/model_loader.h"
+#include "instance_pages.h"
+#include "quaternion.h"
+#include "collision.h"
+#include "level.h"
+#include "bvh.h"
+#include "instance_bvh.h"
+#include "chunk_stream.h"
+#include "scene_store.h"
+#include "level_builder.h"
 
 #include <iostream>
 #include <stdlib.h>
+#include <string.h>
 #include <vector>
+#include <algorithm>
 #include <math.h>
 #include <unistd.h>
 #include <time.h>
+#include <random>
+#include <deque>
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
 void processInput(GLFWwindow *window);
-void makeSphere(float radius, float sectorCount, float stackCount, std::vector<float>& vertices, std::vector<float>& normals, std::vector<unsigned int>& indices);
+void markInputEvent();
+void probeInputLatency();
+void collectInputLatency(bool wait);
+void limitFrameRate(double frameStartTime, double fps);
+void printInputLatency();
+void makeSphere(float radius, float sectorCount, float stackCount, std::vector<float>& vertices, std::vector<unsigned int>& indices);
 void drawScene();
+glm::mat4 modelPlacement(const Model &model, size_t index, size_t count);
+glm::mat4 obstaclePlacement(const Model &model, size_t index, unsigned int seed, float sphereRadius);
 
 // settings
 const unsigned int SCR_WIDTH = 1600;
 const unsigned int SCR_HEIGHT = 900;
 
-// camera
-Camera camera(glm::vec3(0.9f, 0.9f, 0.9f));
+// camera, and with it the sphere, starts here on every level
+const glm::vec3 SPHERE_START(0.9f, 0.9f, 0.9f);
+Camera camera(SPHERE_START);
 float lastX = (float)SCR_WIDTH / 2.0;
 float lastY = (float)SCR_HEIGHT / 2.0;
 bool firstMouse = true;
@@ -39,7 +66,7 @@ Camera camera4(glm::vec3(0.0f, 0.0f, 3.0f));
 float deltaTime = 0.0f;
 float lastFrame = 0.0f;
 
-glm::vec3 sphereMove = glm::vec3(0.9, 0.9, 0.0);
+glm::vec3 sphereMove = SPHERE_START;
 
 bool mouseCamera = false;
 
@@ -48,140 +75,109 @@ bool debugMode = true;
 bool multiScreenMode = true;
 bool endGame = false;
 
-struct Edge3
-{
-
-    glm::vec3 A;
-    glm::vec3 B;
-    glm::vec3 Delta;
-
-    float LengthSquared;
-
-    Edge3(){};
-
-    Edge3(glm::vec3 a, glm::vec3 b)
-    {
-        A = a;
-        B = b;
-        Delta = b - a;
-        LengthSquared = glm::length2(Delta);
-    }
-
-    glm::vec3 PointAt(float t)
-    {
-        return A + t * Delta;
-    }
+// low-latency input: poll and apply input right before rendering, re-latch the view matrix
+// just before submission and optionally run the frame limiter before input sampling
+bool lowLatencyMode = false;
+bool limiterBeforeInput = true;
 
-    float Project(glm::vec3 p)
-    {
-        return glm::dot(p-A, Delta) / LengthSquared;
-    }
-};
-
-struct Plane
+// input-to-photon latency: time of the oldest input event not yet presented, measured when the GPU
+// has finished the frame that shows it (a GL_TIMESTAMP query behind the swap), the same point in both
+// modes, without making the default mode wait for the GPU
+double pendingInputTime = -1.0;
+struct LatencyProbe
 {
-    glm::vec3 Point;
-    glm::vec3 Direction;
-
-    Plane(){};
-
-    Plane(glm::vec3 point, glm::vec3 direction )
-    {
-        Point = point;
-        Direction = direction;
-    }
-
-    bool IsAbove(glm::vec3 q)
-    {
-        return glm::dot(Direction, q - Point) > 0;
-    }
-
-    glm::vec3 Project(glm::vec3 p)
-    {
-        glm::vec3 normalizedDirecion = glm::normalize(Direction);
-        return p - (glm::dot(p, normalizedDirecion) - glm::dot(Point, normalizedDirecion)) * normalizedDirecion;
-    }
+    GLuint query;
+    double inputTime;
 };
+std::deque<LatencyProbe> latencyProbes;
+double inputLatencySum = 0.0;
+double inputLatencyMax = 0.0;
+int inputLatencySamples = 0;
 
-struct Triangle
-{
-    Edge3 EdgeAb;
-    Edge3 EdgeBc;
-    Edge3 EdgeCa;
-
-    glm::vec3 A;
-    glm::vec3 B;
-    glm::vec3 C;
-
-    glm::vec3 TriNorm;
-
-    Plane TriPlane;
-    Plane PlaneAb;
-    Plane PlaneBc;
-    Plane PlaneCa;
-
-    Triangle(glm::vec3 a, glm::vec3 b, glm::vec3 c)
-    {
-        EdgeAb = Edge3( a, b );
-        EdgeBc = Edge3( b, c );
-        EdgeCa = Edge3( c, a );
-        TriNorm = glm::cross(a - b, a - c);
-
-        A = a;
-        B = b;
-        C = c;
-
-        PlaneAb = Plane(a, glm::cross(TriNorm, EdgeAb.Delta ));
-        PlaneBc = Plane(b, glm::cross(TriNorm, EdgeBc.Delta ));
-        PlaneCa = Plane(c, glm::cross(TriNorm, EdgeCa.Delta ));
-
-        TriPlane = Plane(A, TriNorm);
-    }
-
-    glm::vec3 ClosestPointTo(glm::vec3 p)
-    {
-        float uab = EdgeAb.Project( p );
-        float uca = EdgeCa.Project( p );
-
-        if (uca > 1 && uab < 0)
-            return A;
+// key 8 prints the render queue statistics of the next frame
+bool printRenderStats = false;
 
-        float ubc = EdgeBc.Project( p );
+// key 9 switches the level between 3-vertex instancing and vertex pulling from buffer textures
+bool vertexPulling = false;
+bool vertexPullingSupported = false;
 
-        if (uab > 1 && ubc < 0)
-            return B;
-
-        if (ubc > 1 && uca < 0)
-            return C;
-
-        if (uab >= 0 && uab <= 1 && !PlaneAb.IsAbove( p ))
-            return EdgeAb.PointAt( uab );
-
-        if (ubc >= 0 && ubc <= 1 && !PlaneBc.IsAbove( p ))
-            return EdgeBc.PointAt( ubc );
-
-        if (uca >= 0 && uca <= 1 && !PlaneCa.IsAbove( p ))
-            return EdgeCa.PointAt( uca );
-
-        return TriPlane.Project( p );
-    }
-};
+// key 0 asks for the level of the next seed, - and = for one with N smaller or larger by one; it is
+// built in the background and swapped in once ready, the current level stays playable meanwhile
+int levelSeedChange = 0;
+int levelSizeChange = 0;
 
 int main( int argc, char** argv )
 {
     int seed = 0;
     int N = 0;
 
-    switch (argc)
+    // options may appear anywhere, the rest are positional: seed, N
+    //   --gpu-level   generate the level in a compute shader instead of on the CPU
+    //   --spin        the triangles keep turning, their rotations are updated on the GPU every frame
+    //   --bench-draw  time drawing the level with instancing and with vertex pulling before starting
+    //   --linear      store the instances in generation order instead of Morton order (SceneStore)
+    //   --bench-layout  time collision queries and drawing with both instance orders before starting
+    //   --model path  show a model on the floor of the cube, may be repeated; models load in the background
+    //   --pak path    read assets from this archive (assetpack) instead of assets.pak next to the executable
+    //   --obstacles n scatter n more copies of every model through the cube as obstacles
+    //   --endless     no cube: an endless level streamed in chunks around the sphere
+    //   --level-file path  endless, with the chunks this file has (levelpack) read from it
+    std::vector<char*> args;
+    bool gpuLevel = false;
+    bool spinLevel = false;
+    bool benchDraw = false;
+    bool mortonOrder = true;
+    bool benchLayout = false;
+    std::vector<std::string> modelPaths;
+    std::string archivePath = FileSystem::executableDirectory() + "/assets.pak";
+    size_t obstacleCount = 0;
+    bool endless = false;
+    std::string levelFile;
+    for (int i = 1; i < argc; i++)
     {
-        case 2:
-            seed = atoi(argv[1]);
+        if (strcmp(argv[i], "--gpu-level") == 0)
+            gpuLevel = true;
+        else if (strcmp(argv[i], "--spin") == 0)
+            spinLevel = true;
+        else if (strcmp(argv[i], "--bench-draw") == 0)
+            benchDraw = true;
+        else if (strcmp(argv[i], "--linear") == 0)
+            mortonOrder = false;
+        else if (strcmp(argv[i], "--bench-layout") == 0)
+            benchLayout = true;
+        else if (strcmp(argv[i], "--model") == 0 && i + 1 < argc)
+            modelPaths.push_back(argv[++i]);
+        else if (strcmp(argv[i], "--pak") == 0 && i + 1 < argc)
+            archivePath = argv[++i];
+        else if (strcmp(argv[i], "--obstacles") == 0 && i + 1 < argc)
+            obstacleCount = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--endless") == 0)
+            endless = true;
+        else if (strcmp(argv[i], "--level-file") == 0 && i + 1 < argc)
+        {
+            levelFile = argv[++i];
+            endless = true;
+        }
+        else
+            args.push_back(argv[i]);
+    }
+
+    // before anything is read; files missing from the archive are still read loose
+    if (FileSystem::mount(archivePath))
+        std::cout << archivePath << ": " << FileSystem::mountedFiles() << " files mounted" << std::endl;
+    else if (FileSystem::exists(archivePath))
+        std::cout << archivePath << ": not an asset archive, reading loose files" << std::endl;
+
+    switch (args.size())
+    {
+        case 1:
+            seed = atoi(args[0]);
             N = 10;
             break;
 
-        case 3:
-            seed = atoi(argv[1]);
-            N = atoi(argv[2]);
+        case 2:
+            seed = atoi(args[0]);
+            N = atoi(args[1]);
             break;
 
         default:
@@ -189,8 +185,12 @@ int main( int argc, char** argv )
             N = 10;
             break;
     }
+    if (N <= 0 || N > (int)MAX_LEVEL_SIZE)
+    {
+        std::cout << "N has to be between 1 and " << MAX_LEVEL_SIZE << std::endl;
+        return -1;
+    }
 
-    srand(seed);
     // glfw: initialize and configure
     // ------------------------------
     glfwInit();
@@ -220,83 +220,53 @@ int main( int argc, char** argv )
 
     // build and compile shaders
     // -------------------------
-    Shader shader("10.1.instancing.vs", "10.1.instancing.fs");
-    Shader sphereShader("sphereShader.vs", "sphereShader.fs");
-    Shader cubeShader("cubeShader.vs", "cubeShader.fs");
+    ShaderPermutations shaders;
+    Shader& shader = shaders.get("10.1.instancing.vs", "10.1.instancing.fs");
+    Shader& sphereShader = shaders.get("sphereShader.vs", "sphereShader.fs", {"SCALE 1.0"});
+    Shader& markerShader = shaders.get("sphereShader.vs", "sphereShader.fs", {"SCALE 0.1", "INSTANCED_MOVE"});
+    Shader& cubeShader = shaders.get("cubeShader.vs", "cubeShader.fs");
+    Shader& modelShader = shaders.get("model.vs", "model.fs");
+
+    // projection and view are shared by all programs through one std140 uniform block
+    // --------------------------------------------------------------------------------
+    const unsigned int matricesBinding = 0;
+    shader.bindUniformBlock("Matrices", matricesBinding);
+    sphereShader.bindUniformBlock("Matrices", matricesBinding);
+    markerShader.bindUniformBlock("Matrices", matricesBinding);
+    cubeShader.bindUniformBlock("Matrices", matricesBinding);
+    modelShader.bindUniformBlock("Matrices", matricesBinding);
+
+    // draws are recorded per frame, sorted and submitted through a cache that skips redundant GL calls
+    RenderQueue renderQueue(matricesBinding);
+    GLStateCache stateCache;
+    unsigned long long renderedFrames = 0;
+    unsigned long long skippedCallsTotal = 0;
+
+    const GLint sphereMoveLocation = sphereShader.getUniformLocation("move");
+
+    // models are imported and decoded on worker threads and uploaded a few milliseconds per frame,
+    // the level is playable meanwhile and every model appears once it is on the GPU
+    ModelLoader modelLoader;
+    for (const std::string &path : modelPaths)
+        modelLoader.load(path);
+    const double modelUploadBudget = 0.002;
+    bool modelSamplersBound = false;
+
+    // every model is an obstacle: one collision mesh per model, shared by its copy on the floor and
+    // the scattered ones; the models are drawn from the same instances
+    InstanceBVH obstacles;
+    std::vector<Model*> obstacleModels;
+    std::vector<bool> modelIsObstacle(modelPaths.size(), false);
+    std::vector<InstanceBVH::Contact> obstacleContacts;
+    std::vector<size_t> stuckObstacles;
 
     // ============================================================ trojkaty
     // ---------------------------------------------------------
-    std::vector<Triangle> triangles;
     glm::vec3 baseX = glm::vec3(-0.05f,  0.05f, 0.0f);
     glm::vec3 baseY = glm::vec3( 0.05f, -0.05f, 0.0f);
     glm::vec3 baseZ = glm::vec3(-0.05f, -0.05f, 0.0f);
     glm::mat3 baseTriangle = glm::mat3(baseX, baseY, baseZ);
 
-    glm::vec3 translations[N*N*N];
-    glm::quat myQuat;
-    glm::vec4 rotations[N*N*N];
-    int index = 0;
-    float offset = 1.0f/N;
-    for (int z = -N; z < N; z+=2)
-    {
-        for (int y = -N; y < N; y += 2)
-        {
-            for (int x = -N; x < N; x += 2)
-            {
-                glm::vec3 translation;
-                translation.x = (float)x / N + offset;
-                translation.y = (float)y / N + offset;
-                translation.z = (float)z / N + offset;
-                translations[index] = translation;
-
-                float rotx = rand() % 360;
-                float roty = rand() % 360;
-                float rotz = rand() % 360;
-                myQuat = glm::quat(glm::vec3(glm::radians(rotx), glm::radians(roty), glm::radians(rotz)));
-                rotations[index++] = glm::vec4(myQuat.x, myQuat.y, myQuat.z, myQuat.w);
-                
-                //glm::mat3 rotationMat = glm::toMat3(myQuat);
-
-                glm::vec3 v_x = glm::vec3( 1.0f - (2.0f*(myQuat.y*myQuat.y)) - (2.0f*(myQuat.z*myQuat.z)),
-                2.0f*myQuat.x*myQuat.y-2.0f*myQuat.z*myQuat.w,
-                2.0f*myQuat.x*myQuat.z+2*myQuat.y*myQuat.w);
-
-                glm::vec3 v_y = glm::vec3( 2.0f*myQuat.x*myQuat.y+2.0f*myQuat.z*myQuat.w, 
-                1-(2.0f*(myQuat.x*myQuat.x))-(2.0f*(myQuat.z*myQuat.z)),
-                2.0f*myQuat.y*myQuat.z-2*myQuat.x*myQuat.w);
-
-                glm::vec3 v_z = glm::vec3( 2.0f*myQuat.x*myQuat.z-2.0f*myQuat.y*myQuat.w,
-                2.0f*myQuat.y*myQuat.z+2.0f*myQuat.x*myQuat.w,
-                1.0f-(2.0f*(myQuat.x*myQuat.x))-(2.0f*(myQuat.y*myQuat.y)));
-
-                glm::mat3 rotationMat = glm::mat3(v_x, v_y, v_z);
-
-                glm::mat3 tempBaseTriangle = baseTriangle;
-                tempBaseTriangle = rotationMat * tempBaseTriangle;
-                triangles.push_back(Triangle(translation + tempBaseTriangle[0], translation + tempBaseTriangle[1], translation + tempBaseTriangle[2]));
-                //triangles.push_back(Triangle(translation + baseX, translation + baseY, translation + baseZ));
-            }
-        }
-    }
-
-    triangles.pop_back();
-
-    std::cout << triangles.size() << std::endl;
-
-    // store instance data in an array buffer
-    // --------------------------------------
-    unsigned int instanceVBO;
-    glGenBuffers(1, &instanceVBO);
-    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * (N*N*N - 1), &translations[0], GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-    unsigned int instanceVBO2;
-    glGenBuffers(1, &instanceVBO2);
-    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO2);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec4) * (N*N*N - 1), &rotations[0], GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, 1);
-
     // set up vertex data (and buffer(s)) and configure vertex attributes
     // ------------------------------------------------------------------
     float quadVertices[] = {
@@ -306,59 +276,213 @@ int main( int argc, char** argv )
         -0.05f, -0.05f, 0.0f, 0.0f, 0.0f, 1.0f
     };
 
-    unsigned int quadVAO, quadVBO;
-    glGenVertexArrays(1, &quadVAO);
+    unsigned int quadVBO;
     glGenBuffers(1, &quadVBO);
-    glBindVertexArray(quadVAO);
     glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), quadVertices, GL_STATIC_DRAW);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
+    // instance data is generated and uploaded one page at a time, all counts are 64-bit;
+    // the last generated triangle is dropped, as it always was.
+    // every instance is a function of (seed, N, index) only (level.glsl), so the level can be
+    // generated on the CPU or by a compute shader with identical results
+    // -----------------------------------------------------------------------------------
+    // an endless level has no fixed part, everything is streamed (ChunkStreamer below)
+    size_t instanceCount = endless ? 0 : (size_t)N * N * N - 1;
+
+    // pages of up to 4M instances, fewer when the translations of a page (3 texels per instance) would
+    // not fit GL_MAX_TEXTURE_BUFFER_SIZE, so vertex pulling works on every driver
+    GLint maxTextureBufferSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTextureBufferSize);
+    size_t instancesPerPage = std::min<size_t>(1 << 22, (size_t)maxTextureBufferSize / 3);
+    vertexPullingSupported = instancesPerPage > 0;
+    InstancePages instancePages(quadVBO, vertexPullingSupported ? instancesPerPage : 1 << 22);
+    // the one host copy of the level, collision reads it and the pages are uploaded from it
+    SceneStore scene(baseTriangle);
+
+    if (endless && (gpuLevel || spinLevel))
+    {
+        std::cout << "--gpu-level and --spin don't stream, the endless level is generated on the CPU and stays still" << std::endl;
+        gpuLevel = false;
+        spinLevel = false;
+    }
 
-    // also set instance data
-    glEnableVertexAttribArray(2);
-    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO); // this attribute comes from a different vertex buffer
-    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glVertexAttribDivisor(2, 1); // tell OpenGL this is an instanced vertex attribute.
+    if (gpuLevel && !GLEW_VERSION_4_3)
+    {
+        std::cout << "--gpu-level needs OpenGL 4.3 compute shaders, generating the level on the CPU" << std::endl;
+        gpuLevel = false;
+    }
+    if (spinLevel && !GLEW_VERSION_4_3)
+    {
+        std::cout << "--spin needs OpenGL 4.3 compute shaders, the level stays still" << std::endl;
+        spinLevel = false;
+    }
+    // only the CPU --spin path looks slots up by instance index
+    bool slotLookup = spinLevel && !gpuLevel;
+    scene.build(N, instanceCount, mortonOrder, slotLookup);
 
-    glEnableVertexAttribArray(3);
-    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO2); // this attribute comes from a different vertex buffer
-    glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)0);
-    glBindBuffer(GL_ARRAY_BUFFER, 1);
-    glVertexAttribDivisor(3, 1); // tell OpenGL this is an instanced vertex attribute.
+    double levelTime = glfwGetTime();
+    if (gpuLevel)
+    {
+        // allocate the pages and let levelgen.comp fill them, only the slots' indices are uploaded
+        scene.uploadPages(instancePages);
+        instancePages.createVertexArrays();
+
+        Shader levelShader("levelgen.comp");
+        generateLevelOnGpu(levelShader, instancePages, seed, N);
+        glDeleteProgram(levelShader.ID);
+        glFinish();
+        levelTime = glfwGetTime() - levelTime;
+
+        size_t compared = 0;
+        float maxDifference = crossCheckLevel(instancePages, scene.indices.data(), seed, N, 1 << 16, compared);
+        std::cout << "level cross-check: " << compared << " instances compared with the CPU generator, max difference "
+                  << maxDifference << (maxDifference > 1e-5f ? " -- MISMATCH" : "") << std::endl;
+    }
+    else
+    {
+        scene.generate(seed, N);
+        scene.uploadPages(instancePages);
+        instancePages.createVertexArrays();
+        glFinish();
+        levelTime = glfwGetTime() - levelTime;
+    }
+
+    std::cout << instanceCount << std::endl;
+    std::cout << "instances: " << instancePages.instanceCount() << " in " << instancePages.pages.size() << " pages, "
+              << instancePages.bytes() / (1024 * 1024) << "MB, generated on the " << (gpuLevel ? "GPU" : "CPU")
+              << " in " << levelTime * 1000.0 << "ms, " << (mortonOrder ? "Morton" : "generation") << " order" << std::endl;
+    scene.printMemory();
+
+    // vertex pulling: the level as 3 * count plain vertices per page, instance data read through
+    // buffer textures by gl_VertexID / 3; pages are sized to fit GL_MAX_TEXTURE_BUFFER_SIZE texels
+    Shader& pullingShader = shaders.get("10.2.pulling.vs", "10.1.instancing.fs");
+    pullingShader.bindUniformBlock("Matrices", matricesBinding);
+    pullingShader.use();
+    pullingShader.setInt("translations", 0);
+    pullingShader.setInt("rotations", 1);
+    for (int i = 0; i < 3; i++)
+        pullingShader.setVec3("corners[" + std::to_string(i) + "]", baseTriangle[i]);
+
+    if (vertexPullingSupported)
+        instancePages.enableBufferTextures();
+    else
+        std::cout << "vertex pulling disabled: no buffer textures (GL_MAX_TEXTURE_BUFFER_SIZE " << maxTextureBufferSize << ")" << std::endl;
+
+    // a core context can't draw without a VAO, vertex pulling binds an empty one
+    unsigned int pullingVAO;
+    glGenVertexArrays(1, &pullingVAO);
+
+    // the level's draws for one view, one per page
+    ChunkStreamer* streamer = nullptr;
+    auto recordLevel = [&](RenderQueue &queue, unsigned int view, bool pulled)
+    {
+        if (streamer != nullptr)
+            streamer->record(queue, view, shader.ID);
+        for (const InstancePages::Page &page : instancePages.pages)
+        {
+            if (pulled)
+                queue.drawArraysPulled(view, 0, pullingShader.ID, pullingVAO, GL_TRIANGLES, 3 * page.count,
+                                       page.translationTexture, page.rotationTexture);
+            else
+                queue.drawArraysInstanced(view, 0, shader.ID, page.VAO, GL_TRIANGLES, 3, page.count);
+        }
+    };
+
+    // with a GPU level the CPU only builds collision triangles around the sphere, on demand;
+    // a spinning level also uses it to find the triangles that have to be brought up to date
+    NeighborhoodCollider neighborhood(seed, N, instanceCount, baseTriangle);
+
+    // a CPU level keeps a BVH over the triangles of all its slots
+    std::unique_ptr<BVH> triangleBVH(new BVH());
+    std::vector<size_t> bvhCandidates;
+    if (!gpuLevel)
+    {
+        double bvhTime = glfwGetTime();
+        std::vector<AABB> triangleBoxes;
+        scene.triangleBoxes(triangleBoxes);
+        triangleBVH->build(triangleBoxes);
+        std::cout << "triangle BVH: " << triangleBVH->nodeCount() << " nodes, SAH cost " << triangleBVH->sahCost()
+                  << ", built in " << (glfwGetTime() - bvhTime) * 1000.0 << "ms" << std::endl;
+    }
+
+    // a spinning level keeps its clock in [0, SPIN_PERIOD), the GPU and the collider use the same value
+    Shader* spinShader = spinLevel ? new Shader("levelspin.comp") : nullptr;
+    float spinTime = 0.0f;
+
+    // an endless level keeps the chunks within 2 of the sphere's, generated on a worker and uploaded
+    // within 1ms a frame
+    if (endless)
+        streamer = new ChunkStreamer(seed, N, 2, baseTriangle, quadVBO, levelFile);
+    const double streamBudget = 0.001;
+
+    // new levels (keys 0, - and =) are built on a worker with its own shared context; a regenerated
+    // level is always generated on the CPU, as it needs all its triangles for collision anyway
+    LevelBuilder* levelBuilder = new LevelBuilder(window, quadVBO, instancePages.instancesPerPage(), baseTriangle,
+                                                  mortonOrder, slotLookup);
 
     // ============================================================ trojkaty end
 
     // ============================================================ sphere
     std::vector<float> vertices;
-    std::vector<float> normals;
     std::vector<unsigned int> indices;
     float sphereRadius = 0.05f * (10.0f/N);
-    makeSphere(sphereRadius, 32, 32, vertices, normals, indices);
-    
-    float* verticesArray = &vertices[0];
-    unsigned int* indicesArray = &indices[0];
 
     unsigned int vaoId, vboId, iboId;
     glGenVertexArrays(1, &vaoId);
     glGenBuffers(1, &vboId);
+    glGenBuffers(1, &iboId);
+    GLenum sphereIndexType = GL_UNSIGNED_INT;
+
+    // the sphere's size follows N, so a new level brings a new mesh into the same buffers
+    auto buildSphere = [&](float radius)
+    {
+        vertices.clear();
+        indices.clear();
+        makeSphere(radius, 32, 32, vertices, indices);
+
+        // vertex cache, overdraw and fetch order; the sphere and the markers share the optimized mesh
+        size_t sphereVertexCount = vertices.size() / 6;
+        optimizeMesh(indices, &vertices[0], sphereVertexCount, 6 * sizeof(float), 0).print("sphere mesh");
+        vertices.resize(sphereVertexCount * 6);
+
+        glBindVertexArray(vaoId);
+        glBindBuffer(GL_ARRAY_BUFFER, vboId);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), &vertices[0], GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iboId);
+        sphereIndexType = uploadIndices(indices, sphereVertexCount);
+        glBindVertexArray(0);
+    };
+    buildSphere(sphereRadius);
+
     glBindVertexArray(vaoId);
     glBindBuffer(GL_ARRAY_BUFFER, vboId);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), verticesArray, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
 
-    glGenBuffers(1, &iboId);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
+
+    // debug markers: the same sphere mesh instanced, one position per instance streamed every frame
+    // (capped, very large levels simply don't get markers)
+    const size_t maxMarkers = 1 << 20;
+    StreamBuffer markerStream(GL_ARRAY_BUFFER, std::max<size_t>(std::min(instanceCount, maxMarkers), 1) * sizeof(glm::vec3));
+
+    unsigned int markerVAO;
+    glGenVertexArrays(1, &markerVAO);
+    glBindVertexArray(markerVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, vboId);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iboId);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indicesArray, GL_STATIC_DRAW);
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
 
     glEnableVertexAttribArray(1);
     glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
 
+    glEnableVertexAttribArray(2);
+    glVertexAttribDivisor(2, 1);
+    glBindVertexArray(0);
+
     // ============================================================ sphere end
 
     // ============================================================ cube
@@ -410,18 +534,132 @@ int main( int argc, char** argv )
     glfwSetCursorPosCallback(window, mouse_callback);
     glfwSetWindowSizeCallback(window, framebuffer_size_callback);
     glfwSetScrollCallback(window, scroll_callback);
+    glfwSetKeyCallback(window, key_callback);
 
     // fps limiter variables declaration
-    double fpsTime = 0;
+    double fpsTime = glfwGetTime();
     const double fps = 60.0;
 
     double keyTime = glfwGetTime();
 
     double playTime = glfwGetTime();
 
+    // GPU milliseconds per frame of the draws record(queue, view) adds to a full-screen view from the
+    // start position, averaged over the timed frames after a few warm-up ones
+    // -------------------------------------------------------------------------------------------------
+    auto gpuDrawTime = [&](auto record) -> double
+    {
+        const int warmupFrames = 5;
+        const int timedFrames = 50;
+        glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 1000.0f);
+        glm::mat4 view = camera.GetViewMatrix();
+
+        GLuint timer;
+        glGenQueries(1, &timer);
+        double gpuTime = 0.0;
+        for (int frame = 0; frame < warmupFrames + timedFrames; frame++)
+        {
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            unsigned int benchView = renderQueue.addView(0, 0, SCR_WIDTH, SCR_HEIGHT, true, projection, view);
+            record(renderQueue, benchView);
+
+            stateCache.invalidate();
+            glBeginQuery(GL_TIME_ELAPSED, timer);
+            renderQueue.flush(stateCache);
+            glEndQuery(GL_TIME_ELAPSED);
+
+            GLuint64 elapsed = 0;
+            glGetQueryObjectui64v(timer, GL_QUERY_RESULT, &elapsed);
+            if (frame >= warmupFrames)
+                gpuTime += elapsed / 1e6;
+        }
+        glDeleteQueries(1, &timer);
+        return gpuTime / timedFrames;
+    };
+
+    // GPU time of drawing the whole level from the start position, instancing against vertex pulling
+    // -------------------------------------------------------------------------------------------------
+    if (benchDraw)
+    {
+        for (int pulled = 0; pulled < (vertexPullingSupported ? 2 : 1); pulled++)
+        {
+            double gpuTime = gpuDrawTime([&](RenderQueue &queue, unsigned int view) { recordLevel(queue, view, pulled); });
+            std::cout << "draw benchmark, " << (pulled ? "vertex pulling" : "instancing    ") << ": "
+                      << gpuTime << "ms GPU per frame for " << instanceCount << " triangles" << std::endl;
+        }
+    }
+
+    // the level in generation order against Morton order: each gets its own scene store, pages and BVH,
+    // the collision queries follow the same random walk of the sphere through the cube and the draws
+    // are timed like above
+    // -------------------------------------------------------------------------------------------------
+    if (benchLayout && !endless)
+    {
+        const int queries = 200000;
+        for (int morton = 0; morton < 2; morton++)
+        {
+            double buildTime = glfwGetTime();
+            SceneStore benchScene(baseTriangle);
+            benchScene.build(N, instanceCount, morton, false);
+            benchScene.generate(seed, N);
+            InstancePages benchPages(quadVBO, instancePages.instancesPerPage());
+            benchScene.uploadPages(benchPages);
+            benchPages.createVertexArrays();
+            if (vertexPullingSupported)
+                benchPages.enableBufferTextures();
+            std::vector<AABB> benchBoxes;
+            benchScene.triangleBoxes(benchBoxes);
+            BVH benchBVH;
+            benchBVH.build(benchBoxes);
+            buildTime = glfwGetTime() - buildTime;
+
+            std::mt19937 random(seed);
+            std::uniform_real_distribution<float> step(-sphereRadius, sphereRadius);
+            glm::vec3 position(0.0f);
+            std::vector<size_t> found;
+            size_t tested = 0;
+            size_t touching = 0;
+            double collisionTime = glfwGetTime();
+            for (int query = 0; query < queries; query++)
+            {
+                position = glm::clamp(position + glm::vec3(step(random), step(random), step(random)), glm::vec3(-1.0f), glm::vec3(1.0f));
+                benchBVH.query(position, sphereRadius, found);
+                for (size_t slot : found)
+                    if (glm::distance2(benchScene.triangle(slot).ClosestPointTo(position), position) < sphereRadius * sphereRadius)
+                        touching++;
+                tested += found.size();
+            }
+            collisionTime = glfwGetTime() - collisionTime;
+
+            std::cout << "layout benchmark, " << (morton ? "Morton order    " : "generation order") << ": built in "
+                      << buildTime * 1000.0 << "ms, " << collisionTime * 1e9 / queries << "ns per sphere query ("
+                      << tested << " triangles tested, " << touching << " touching)";
+            for (int pulled = 0; pulled < (vertexPullingSupported ? 2 : 1); pulled++)
+            {
+                double gpuTime = gpuDrawTime([&](RenderQueue &queue, unsigned int view) {
+                    for (const InstancePages::Page &page : benchPages.pages)
+                    {
+                        if (pulled)
+                            queue.drawArraysPulled(view, 0, pullingShader.ID, pullingVAO, GL_TRIANGLES, 3 * page.count,
+                                                   page.translationTexture, page.rotationTexture);
+                        else
+                            queue.drawArraysInstanced(view, 0, shader.ID, page.VAO, GL_TRIANGLES, 3, page.count);
+                    }
+                });
+                std::cout << ", " << gpuTime << "ms GPU per frame " << (pulled ? "pulled" : "instanced");
+            }
+            std::cout << std::endl;
+            benchPages.release();
+        }
+    }
+
     // render loop
     // -----------
     do {
+        // low-latency mode sleeps before input is sampled instead of between render and swap
+        if (lowLatencyMode && limiterBeforeInput)
+            limitFrameRate(fpsTime, fps);
+
         fpsTime = glfwGetTime();
 
         // per-frame time logic
@@ -434,87 +672,133 @@ int main( int argc, char** argv )
         int winHeight = 0;
         glfwGetWindowSize(window, &winWidth, &winHeight);
 
-        if (multiScreenMode)
-            glViewport(-winWidth/4, 0, winWidth, winHeight);
-        else
-            glViewport(0, 0, winWidth, winHeight);
-        
-
         // input
         // -----
+        if (lowLatencyMode)
+            glfwPollEvents();
+
         glm::vec3 cameraLastPos = camera.getPosition();
         processInput(window);
 
-        // render
-        // ------
-        glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        // configure transformation matrices
-        camera.setPosition(camera.getPosition() - (camera.GetFront() / glm::vec3(3, 3, 3)));
-        glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 1000.0f);
-        glm::mat4 view = camera.GetViewMatrix();
-        camera.setPosition(camera.getPosition() + camera.GetFront() / glm::vec3(3, 3, 3));
+        // a new level: start building it, or swap it in if it's done; the swap happens here, before
+        // anything of this frame touches the level, so a frame sees either the old level or the new one
+        // ---------------------------------------------------------------------------------------------
+        if (levelSeedChange != 0 || levelSizeChange != 0)
+        {
+            int nextN = std::min((int)MAX_LEVEL_SIZE, std::max(2, N + levelSizeChange));
+            if (endless)
+                std::cout << "the endless level can't be regenerated" << std::endl;
+            else if (levelBuilder->busy())
+                std::cout << "a level is already being built" << std::endl;
+            else if (levelBuilder->start(seed + levelSeedChange, nextN))
+                std::cout << "building level: seed " << seed + levelSeedChange << ", N " << nextN << std::endl;
+            levelSeedChange = 0;
+            levelSizeChange = 0;
+        }
+        std::unique_ptr<BuiltLevel> level = levelBuilder->take();
+        if (level)
+        {
+            instancePages.swapPages(level->pages);
+            instancePages.createVertexArrays();
+            scene.swap(level->scene);
+            triangleBVH.swap(level->bvh);
+            seed = level->seed;
+            N = level->N;
+            instanceCount = instancePages.instanceCount();
+            neighborhood = NeighborhoodCollider(seed, N, instanceCount, baseTriangle);
+            gpuLevel = false;
+
+            sphereRadius = 0.05f * (10.0f/N);
+            buildSphere(sphereRadius);
+            camera.setPosition(SPHERE_START);
+            sphereMove = camera.getPosition();
+            cameraLastPos = sphereMove;
+            playTime = glfwGetTime();
+
+            std::cout << "level: seed " << seed << ", N " << N << ", " << instanceCount << " instances, built in "
+                      << level->seconds * 1000.0 << "ms" << std::endl;
+            levelBuilder->retire(std::move(level));
+        }
 
-        // draw N*N*N instanced teriangles
-        shader.use();
-        shader.setMat4("projection", projection);
-        shader.setMat4("view", view);
+        // check collisions before the view matrix is latched, so the frame shows the resolved position
+        // ---------------------------------------------------------------------------------------------
+        // turn the level: the GPU rewrites every rotation, the CPU only rebuilds what collides below
+        if (spinLevel)
+        {
+            spinTime = std::fmod(spinTime + deltaTime, SPIN_PERIOD);
+            spinLevelOnGpu(*spinShader, instancePages, seed, spinTime);
+            neighborhood.setTime(spinTime);
+        }
 
-        glBindVertexArray(quadVAO);
-        glDrawArraysInstanced(GL_TRIANGLES, 0, 3, N*N*N); // 1000 triangles of 6 vertices each
-        glBindVertexArray(0);
+        // only the triangles the sphere can reach are tested: a GPU level rebuilds them from the grid,
+        // a CPU level finds them in its BVH. Triangles of a spinning CPU level are only brought up to
+        // date around the sphere; the ones left behind are stale, but can't reach the sphere either,
+        // so the refitted BVH still answers exactly. The neighborhood finds instance indices, the BVH
+        // finds slots of the scene store.
+        const std::vector<size_t>* candidates = &neighborhood.nearby;
+        if (gpuLevel || spinLevel)
+            neighborhood.query(sphereMove, sphereRadius);
+        if (!gpuLevel)
+        {
+            if (spinLevel)
+            {
+                for (size_t index : neighborhood.nearby)
+                {
+                    size_t slot = scene.slots[index];
+                    scene.rotations[slot] = animatedRotation(seed, (unsigned int)index, spinTime);
+                    triangleBVH->update(slot, triangleBounds(scene.triangle(slot)));
+                }
+            }
+            triangleBVH->refit();
+            triangleBVH->query(sphereMove, sphereRadius, bvhCandidates);
+            candidates = &bvhCandidates;
+        }
+        size_t collisionCount = candidates->size();
 
-        //draw sphere
-        glBindVertexArray(vaoId);
-        glBindBuffer(GL_ARRAY_BUFFER, vboId);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iboId);
-        sphereShader.use();
-        sphereShader.setMat4("projection", projection);
-        sphereShader.setMat4("view", view);
-        sphereShader.setVec3("move", sphereMove);
-        sphereShader.setFloat("scale", 1);
-        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, (void*)0);
-        glBindVertexArray(0);
+        // the streamed chunks around the sphere; a chunk that hasn't arrived yet holds the sphere back
+        if (streamer != nullptr)
+        {
+            streamer->update(sphereMove, streamBudget);
+            if (streamer->collides(sphereMove, sphereRadius))
+                camera.setPosition(cameraLastPos);
+        }
 
-        //draw cube
-        glBindVertexArray(cubeVao);
-        glBindBuffer(GL_ARRAY_BUFFER, cubeVbo);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cubeIbo);
-        cubeShader.use();
-        cubeShader.setMat4("projection", projection);
-        cubeShader.setMat4("view", view);
-        glDrawElements(GL_TRIANGLES, 12*3, GL_UNSIGNED_INT, (void*)0);
-        glBindVertexArray(0);
+        // model obstacles: the sphere against the instances around it, tested in each one's own space;
+        // the move is also cast as a segment, so a fast sphere can't pass through a thin model in one frame.
+        // Models are placed as they finish loading and may appear on top of the sphere; the instances it
+        // already touched before the move don't hold it, so it can always move out of them
+        InstanceBVH::Hit obstacleHit;
+        stuckObstacles.clear();
+        obstacles.query(cameraLastPos, sphereRadius, obstacleContacts, stuckObstacles);
+        for (const InstanceBVH::Contact &contact : obstacleContacts)
+            if (std::find(stuckObstacles.begin(), stuckObstacles.end(), contact.instance) == stuckObstacles.end())
+                stuckObstacles.push_back(contact.instance);
+        obstacles.query(sphereMove, sphereRadius, obstacleContacts, stuckObstacles);
+        if (!obstacleContacts.empty() ||
+            obstacles.raycast(cameraLastPos, sphereMove - cameraLastPos, 1.0f, obstacleHit, stuckObstacles))
+            camera.setPosition(cameraLastPos);
 
-        //check collisions and draw closest point
+        // in debug mode the closest points go straight into this frame's region of the marker ring
+        markerStream.beginFrame();
+        GLintptr markerOffset = 0;
+        glm::vec3* markers = nullptr;
         if (debugMode)
-        {
-            glBindVertexArray(vaoId);
-            glBindBuffer(GL_ARRAY_BUFFER, vboId);
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iboId);
-            sphereShader.use();
-            sphereShader.setMat4("projection", projection);
-            sphereShader.setMat4("view", view);
-            sphereShader.setFloat("scale", 0.1);
-        }
+            markers = (glm::vec3*)markerStream.allocate(collisionCount * sizeof(glm::vec3), sizeof(glm::vec3), markerOffset);
 
-        for(int i = 0; i < triangles.size(); i++)
+        for(size_t i = 0; i < collisionCount; i++)
         {
-            glm::vec3 closestPoint = triangles[i].ClosestPointTo(sphereMove);
+            size_t candidate = (*candidates)[i];
+            Triangle triangle = gpuLevel ? neighborhood.triangle(candidate) : scene.triangle(candidate);
+            glm::vec3 closestPoint = triangle.ClosestPointTo(sphereMove);
+            if (markers != nullptr)
+                markers[i] = closestPoint;
 
-            if (debugMode)
-            {
-                sphereShader.setVec3("move", closestPoint);
-                glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, (void*)0);
-            }
-            
             if (glm::distance2(closestPoint, sphereMove) < sphereRadius * sphereRadius)
             {
                 camera.setPosition(cameraLastPos);
                 //std::cout << "collision" << std::endl;
 
-                if (i == 0)
+                if ((gpuLevel ? candidate : scene.indices[candidate]) == 0)
                 {
                     std::cout << "win" << std::endl;
                     endGame = true;
@@ -523,105 +807,122 @@ int main( int argc, char** argv )
             }
         }
 
-        if (sphereMove.x >= (1.0f - sphereRadius) || sphereMove.x <= -(1.0f - sphereRadius) ||
-            sphereMove.y >= (1.0f - sphereRadius) || sphereMove.y <= -(1.0f - sphereRadius) ||
-            sphereMove.z >= (1.0f - sphereRadius) || sphereMove.z <= -(1.0f - sphereRadius))
+        if (!endless &&
+            (sphereMove.x >= (1.0f - sphereRadius) || sphereMove.x <= -(1.0f - sphereRadius) ||
+             sphereMove.y >= (1.0f - sphereRadius) || sphereMove.y <= -(1.0f - sphereRadius) ||
+             sphereMove.z >= (1.0f - sphereRadius) || sphereMove.z <= -(1.0f - sphereRadius)))
         {
             camera.setPosition(cameraLastPos);
         }
-        
 
-        glBindVertexArray(0);
+        // late latch: pick up mouse look that arrived during the frame right before the view is built
+        if (lowLatencyMode)
+            glfwPollEvents();
 
-        if (multiScreenMode)
-        {
-            glDisable(GL_DEPTH_TEST);
-            // small view 1
-            glViewport((winWidth/4) * 3, (winHeight/4) * 3, winWidth/4, winHeight/4);
+        // render
+        // ------
+        glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-            projection = glm::perspective(glm::radians(45.0f), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 2000.0f);
-            view = camera2.GetViewMatrix(glm::vec3(0,0,0));
+        // configure transformation matrices
+        camera.setPosition(camera.getPosition() - (camera.GetFront() / glm::vec3(3, 3, 3)));
+        glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 1000.0f);
+        glm::mat4 view = camera.GetViewMatrix();
+        camera.setPosition(camera.getPosition() + camera.GetFront() / glm::vec3(3, 3, 3));
 
-            // draw 1000 instanced teriangles
-            shader.use();
-            shader.setMat4("projection", projection);
-            shader.setMat4("view", view);
+        unsigned int mainView;
+        if (multiScreenMode)
+            mainView = renderQueue.addView(-winWidth/4, 0, winWidth, winHeight, true, projection, view);
+        else
+            mainView = renderQueue.addView(0, 0, winWidth, winHeight, true, projection, view);
 
-            glBindVertexArray(quadVAO);
-            glDrawArraysInstanced(GL_TRIANGLES, 0, 3, N*N*N); // 1000 triangles of 6 vertices each
-            glBindVertexArray(0);
+        // draw N*N*N teriangles, the sphere and the cube
+        recordLevel(renderQueue, mainView, vertexPulling);
+        renderQueue.drawElements(mainView, 0, sphereShader.ID, vaoId, GL_TRIANGLES, indices.size(), sphereIndexType,
+                                 sphereMoveLocation, sphereMove);
+        renderQueue.drawElements(mainView, 0, cubeShader.ID, cubeVao, GL_TRIANGLES, 12*3, GL_UNSIGNED_INT);
 
-            //draw sphere
-            glBindVertexArray(vaoId);
-            glBindBuffer(GL_ARRAY_BUFFER, vboId);
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iboId);
-            sphereShader.use();
-            sphereShader.setMat4("projection", projection);
-            sphereShader.setMat4("view", view);
-            sphereShader.setVec3("move", sphereMove);
-            sphereShader.setFloat("scale", 1);
-            glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, (void*)0);
+        //draw closest points
+        markerStream.finishWrites();
+        if (markers != nullptr)
+        {
+            glBindVertexArray(markerVAO);
+            glBindBuffer(GL_ARRAY_BUFFER, markerStream.buffer());
+            glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)markerOffset);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
             glBindVertexArray(0);
 
-            // small view 2
-            glViewport((winWidth/4) * 3, (winHeight/4) * 2, winWidth/4, winHeight/4);
+            renderQueue.drawElementsInstanced(mainView, 0, markerShader.ID, markerVAO, GL_TRIANGLES, indices.size(), sphereIndexType,
+                                              collisionCount);
+        }
 
+        if (multiScreenMode)
+        {
+            // small views 1-3 look at the cube from three sides, drawn without depth test,
+            // so the sphere goes to a later layer to stay on top of the triangles
             projection = glm::perspective(glm::radians(45.0f), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 2000.0f);
-            view = camera3.GetViewMatrix(glm::vec3(0,0,0));
-
-            // draw 1000 instanced teriangles
-            shader.use();
-            shader.setMat4("projection", projection);
-            shader.setMat4("view", view);
-
-            glBindVertexArray(quadVAO);
-            glDrawArraysInstanced(GL_TRIANGLES, 0, 3, N*N*N); // 1000 triangles of 6 vertices each
-            glBindVertexArray(0);
+            Camera* smallViewCameras[] = { &camera2, &camera3, &camera4 };
 
-            //draw sphere
-            glBindVertexArray(vaoId);
-            glBindBuffer(GL_ARRAY_BUFFER, vboId);
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iboId);
-            sphereShader.use();
-            sphereShader.setMat4("projection", projection);
-            sphereShader.setMat4("view", view);
-            sphereShader.setVec3("move", sphereMove);
-            sphereShader.setFloat("scale", 1);
-            glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, (void*)0);
-            glBindVertexArray(0);
-
-            // small view 3
-            glViewport((winWidth/4) * 3, (winHeight/4) * 1, winWidth/4, winHeight/4);
+            for (int i = 0; i < 3; i++)
+            {
+                view = smallViewCameras[i]->GetViewMatrix(glm::vec3(0,0,0));
+                unsigned int smallView = renderQueue.addView((winWidth/4) * 3, (winHeight/4) * (3 - i), winWidth/4, winHeight/4,
+                                                             false, projection, view);
 
-            projection = glm::perspective(glm::radians(45.0f), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 2000.0f);
-            view = camera4.GetViewMatrix(glm::vec3(0,0,0));
+                recordLevel(renderQueue, smallView, vertexPulling);
+                renderQueue.drawElements(smallView, 1, sphereShader.ID, vaoId, GL_TRIANGLES, indices.size(), sphereIndexType,
+                                         sphereMoveLocation, sphereMove);
+            }
+        }
 
-            // draw 1000 instanced teriangles
-            shader.use();
-            shader.setMat4("projection", projection);
-            shader.setMat4("view", view);
+        // GL state may have been touched outside the cache (e.g. the resize callback), start clean each frame
+        stateCache.invalidate();
+        stateCache.resetCounters();
+        renderQueue.flush(stateCache);
 
-            glBindVertexArray(quadVAO);
-            glDrawArraysInstanced(GL_TRIANGLES, 0, 3, N*N*N); // 1000 triangles of 6 vertices each
-            glBindVertexArray(0);
+        // the models draw themselves (one multi-draw each), in the main view after the queue
+        if (!modelLoader.done())
+            modelLoader.update(modelUploadBudget);
+        for (size_t i = 0; i < modelLoader.size(); i++)
+        {
+            Model* model = modelLoader.get(i);
+            if (model == nullptr || modelIsObstacle[i])
+                continue;
+            size_t mesh = obstacles.addMesh(std::move(model->collisionTriangles));
+            obstacleModels.push_back(model);
+            obstacles.addInstance(mesh, modelPlacement(*model, i, modelLoader.size()));
+            for (size_t k = 0; k < obstacleCount; k++)
+                obstacles.addInstance(mesh, obstaclePlacement(*model, k, seed + i, sphereRadius));
+            modelIsObstacle[i] = true;
+        }
+        for (const InstanceBVH::Instance &instance : obstacles.instances)
+        {
+            Model* model = obstacleModels[instance.mesh];
+            if (!modelSamplersBound)
+            {
+                model->materialLibrary().bindSamplers(modelShader);
+                modelSamplersBound = true;
+            }
+            renderQueue.bindFlushedView(stateCache, mainView);
+            stateCache.useProgram(modelShader.ID);
+            modelShader.setMat4("model", instance.toWorld);
+            model->Draw();
+            stateCache.invalidate();
+        }
+        markerStream.endFrame();
+        renderedFrames++;
+        skippedCallsTotal += stateCache.skippedCalls;
 
-            //draw sphere
-            glBindVertexArray(vaoId);
-            glBindBuffer(GL_ARRAY_BUFFER, vboId);
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iboId);
-            sphereShader.use();
-            sphereShader.setMat4("projection", projection);
-            sphereShader.setMat4("view", view);
-            sphereShader.setVec3("move", sphereMove);
-            sphereShader.setFloat("scale", 1);
-            glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, (void*)0);
-            glBindVertexArray(0);
-            
-            glEnable(GL_DEPTH_TEST);
+        if (printRenderStats)
+        {
+            std::cout << "render queue: " << renderQueue.commandsLastFrame << " draws, "
+                      << stateCache.issuedCalls << " state calls issued, "
+                      << stateCache.skippedCalls << " redundant calls skipped this frame" << std::endl;
+            printRenderStats = false;
         }
 
-        double fpsElapsedTime = glfwGetTime() - fpsTime;
-        usleep((100/fps - fpsElapsedTime) * 1000);
+        if (!(lowLatencyMode && limiterBeforeInput))
+            limitFrameRate(fpsTime, fps);
 
         if (glfwGetTime() - keyTime > 1)
         {
@@ -633,16 +934,53 @@ int main( int argc, char** argv )
         // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
         // -------------------------------------------------------------------------------
         glfwSwapBuffers(window);
-        glfwPollEvents();
+
+        // in low-latency mode wait for the frame to finish, so the driver can't queue frames ahead of input
+        if (lowLatencyMode)
+            glFinish();
+
+        probeInputLatency();
+        collectInputLatency(false);
+
+        if (!lowLatencyMode)
+            glfwPollEvents();
     }
     while( glfwGetKey(window, GLFW_KEY_ESCAPE ) != GLFW_PRESS &&
                 glfwWindowShouldClose(window) == 0 &&
                 !endGame);
 
+    printInputLatency();
+    if (renderedFrames > 0)
+        std::cout << "render queue: " << (double)skippedCallsTotal / renderedFrames << " GL calls saved per frame on average" << std::endl;
+    markerStream.printStats("debug markers");
+    if (!modelPaths.empty())
+    {
+        TextureCache::instance().printStats();
+        size_t obstacleTriangles = 0;
+        for (size_t i = 0; i < obstacles.meshCount(); i++)
+            obstacleTriangles += obstacles.mesh(i).vertices.size() / 3;
+        std::cout << "obstacles: " << obstacles.instances.size() << " instances of " << obstacles.meshCount()
+                  << " meshes, " << obstacleTriangles << " triangles kept for collision" << std::endl;
+    }
+    if (streamer != nullptr)
+        streamer->printStats();
+    if (!gpuLevel)
+        std::cout << "triangle BVH: SAH cost " << triangleBVH->sahCost() << ", " << triangleBVH->rebuilds
+                  << " background rebuilds" << std::endl;
+
     // optional: de-allocate all resources once they've outlived their purpose:
     // ------------------------------------------------------------------------
-    glDeleteVertexArrays(1, &quadVAO);
+    instancePages.release();
+    if (spinShader != nullptr)
+    {
+        glDeleteProgram(spinShader->ID);
+        delete spinShader;
+    }
+    delete streamer;
+    delete levelBuilder;
     glDeleteBuffers(1, &quadVBO);
+    glDeleteVertexArrays(1, &markerVAO);
+    glDeleteVertexArrays(1, &pullingVAO);
 
     glfwTerminate();
     return 0;
@@ -693,6 +1031,13 @@ void processInput(GLFWwindow *window)
     {
         sphereMove = sphereMove + move[0] + move[1];
     }
+    // held keys are sampled here rather than delivered as events, so the sample time is the event time
+    if (!move.empty() ||
+        glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS ||
+        glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS)
+    {
+        markInputEvent();
+    }
     sphereMove = camera.getPosition();
 
     if (glfwGetKey(window, GLFW_KEY_1) == GLFW_PRESS && keyClicked != 1)
@@ -736,6 +1081,130 @@ void processInput(GLFWwindow *window)
         
         keyClicked = 5;
     }
+
+    if (glfwGetKey(window, GLFW_KEY_6) == GLFW_PRESS && keyClicked != 6)
+    {
+        printInputLatency();
+        lowLatencyMode = !lowLatencyMode;
+        std::cout << "low-latency mode: " << (lowLatencyMode ? "on" : "off") << std::endl;
+
+        keyClicked = 6;
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_7) == GLFW_PRESS && keyClicked != 7)
+    {
+        printInputLatency();
+        limiterBeforeInput = !limiterBeforeInput;
+        std::cout << "frame limiter before input: " << (limiterBeforeInput ? "on" : "off") << std::endl;
+
+        keyClicked = 7;
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_8) == GLFW_PRESS && keyClicked != 8)
+    {
+        printRenderStats = true;
+        keyClicked = 8;
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_9) == GLFW_PRESS && keyClicked != 9 && vertexPullingSupported)
+    {
+        vertexPulling = !vertexPulling;
+        std::cout << "level drawn with " << (vertexPulling ? "vertex pulling" : "instancing") << std::endl;
+        keyClicked = 9;
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_0) == GLFW_PRESS && keyClicked != 10)
+    {
+        levelSeedChange = 1;
+        keyClicked = 10;
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_MINUS) == GLFW_PRESS && keyClicked != 11)
+    {
+        levelSizeChange = -1;
+        keyClicked = 11;
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_EQUAL) == GLFW_PRESS && keyClicked != 12)
+    {
+        levelSizeChange = 1;
+        keyClicked = 12;
+    }
+}
+
+// remember the time of the oldest input event that hasn't reached the screen yet
+// ---------------------------------------------------------------------------------------------------------
+void markInputEvent()
+{
+    if (pendingInputTime < 0.0)
+        pendingInputTime = glfwGetTime();
+}
+
+// the frame just swapped shows the pending input: time stamp the point the GPU finishes it
+// ---------------------------------------------------------------------------------------------------------
+void probeInputLatency()
+{
+    if (pendingInputTime < 0.0)
+        return;
+    LatencyProbe probe;
+    glGenQueries(1, &probe.query);
+    glQueryCounter(probe.query, GL_TIMESTAMP);
+    probe.inputTime = pendingInputTime;
+    latencyProbes.push_back(probe);
+    pendingInputTime = -1.0;
+}
+
+// latency samples of the probed frames the GPU has finished, oldest first; with wait all of them.
+// The GPU clock is mapped onto glfwGetTime() by reading both now
+// ---------------------------------------------------------------------------------------------------------
+void collectInputLatency(bool wait)
+{
+    while (!latencyProbes.empty())
+    {
+        LatencyProbe probe = latencyProbes.front();
+        GLint available = 0;
+        if (!wait)
+            glGetQueryObjectiv(probe.query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!wait && !available)
+            return;
+        GLuint64 finished = 0;
+        glGetQueryObjectui64v(probe.query, GL_QUERY_RESULT, &finished);
+        GLint64 gpuNow = 0;
+        glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+        double latency = glfwGetTime() - (double)(gpuNow - (GLint64)finished) / 1e9 - probe.inputTime;
+        inputLatencySum += latency;
+        inputLatencyMax = std::max(inputLatencyMax, latency);
+        inputLatencySamples++;
+        glDeleteQueries(1, &probe.query);
+        latencyProbes.pop_front();
+    }
+}
+
+// sleep for the rest of the frame budget measured from frameStartTime
+// ---------------------------------------------------------------------------------------------------------
+void limitFrameRate(double frameStartTime, double fps)
+{
+    double fpsElapsedTime = glfwGetTime() - frameStartTime;
+    double sleepTime = (100/fps - fpsElapsedTime) * 1000;
+    if (sleepTime > 0)
+        usleep(sleepTime);
+}
+
+// print input-to-photon latency gathered since the last report and reset the counters
+// ---------------------------------------------------------------------------------------------------------
+void printInputLatency()
+{
+    collectInputLatency(true);
+    if (inputLatencySamples > 0)
+    {
+        std::cout << "input latency (" << (lowLatencyMode ? "low-latency" : "default") << " mode): avg "
+                  << inputLatencySum / inputLatencySamples * 1000.0 << "ms, max "
+                  << inputLatencyMax * 1000.0 << "ms over " << inputLatencySamples << " events" << std::endl;
+    }
+
+    inputLatencySum = 0.0;
+    inputLatencyMax = 0.0;
+    inputLatencySamples = 0;
 }
 
 // glfw: whenever the window size changed (by OS or user resize) this callback function executes
@@ -751,6 +1220,8 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos)
 {
     if (mouseCamera)
     {
+        markInputEvent();
+
         int winWidth = 0;
         int winHeight = 0;
         glfwGetWindowSize(window, &winWidth, &winHeight);
@@ -824,6 +1295,14 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos)
     }
 }
 
+// glfw: whenever a key is pressed or released, this callback is called
+// ----------------------------------------------------------------------
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+    if (action != GLFW_REPEAT)
+        markInputEvent();
+}
+
 // glfw: whenever the mouse scroll wheel scrolls, this callback is called
 // ----------------------------------------------------------------------
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
@@ -831,11 +1310,11 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
     camera.ProcessMouseScroll(yoffset);
 }
 
+// positions and colors only, the sphere shaders have no use for normals
 void makeSphere(float radius, float sectorCount, float stackCount,
-                std::vector<float>& vertices, std::vector<float>& normals, std::vector<unsigned int>& indices)
+                std::vector<float>& vertices, std::vector<unsigned int>& indices)
 {
     float x, y, z, xy;                              // vertex position
-    float nx, ny, nz, lengthInv = 1.0f / radius;    // vertex normal
 
     float sectorStep = 2 * M_PI / sectorCount;
     float stackStep = M_PI / stackCount;
@@ -871,16 +1350,6 @@ void makeSphere(float radius, float sectorCount, float stackCount,
                 hueIncrement = (-hueIncrement);
             if (hue <= 0.0)
                 hueIncrement = (-hueIncrement);
-            
-            
-
-            // normalized vertex normal (nx, ny, nz)
-            nx = x * lengthInv;
-            ny = y * lengthInv;
-            nz = z * lengthInv;
-            normals.push_back(nx);
-            normals.push_back(ny);
-            normals.push_back(nz);
         }
     }    
     
@@ -912,3 +1381,48 @@ void makeSphere(float radius, float sectorCount, float stackCount,
         }
     }
 }
+
+// model `index` of `count` in a row on the floor of the cube, scaled to fit its slot
+// ---------------------------------------------------------------------------------------------------------
+glm::mat4 modelPlacement(const Model &model, size_t index, size_t count)
+{
+    glm::vec3 extent = model.boundsMax - model.boundsMin;
+    float size = std::max(extent.x, std::max(extent.y, extent.z));
+    float slot = 2.0f / count;
+    float scale = size > 0.0f ? std::min(0.3f, 0.8f * slot) / size : 1.0f;
+    glm::vec3 center = (model.boundsMin + model.boundsMax) * 0.5f;
+
+    glm::mat4 placement = glm::translate(glm::mat4(1.0f), glm::vec3(-1.0f + slot * (index + 0.5f), -1.0f, 0.0f));
+    placement = glm::scale(placement, glm::vec3(scale));
+    return glm::translate(placement, glm::vec3(-center.x, -model.boundsMin.y, -center.z));
+}
+
+// copy `index` of a model scattered through the cube: random position, orientation and a size of
+// about 0.15, kept clear of the sphere at SPHERE_START: in any orientation the copy lies within its
+// scaled bounding radius of position
+// ---------------------------------------------------------------------------------------------------------
+glm::mat4 obstaclePlacement(const Model &model, size_t index, unsigned int seed, float sphereRadius)
+{
+    glm::vec3 extent = model.boundsMax - model.boundsMin;
+    float size = std::max(extent.x, std::max(extent.y, extent.z));
+    float scale = size > 0.0f ? 0.15f / size : 1.0f;
+    float boundingRadius = 0.5f * glm::length(extent) * scale;
+
+    std::mt19937 random(seed * 7919u + (unsigned int)index);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    glm::vec3 position;
+    do
+        position = 0.8f * glm::vec3(unit(random), unit(random), unit(random));
+    while (glm::distance(position, SPHERE_START) < boundingRadius + sphereRadius);
+    glm::vec3 axis(unit(random), unit(random), unit(random));
+    if (glm::dot(axis, axis) < 1e-6f)
+        axis = glm::vec3(0.0f, 1.0f, 0.0f);
+    float angle = M_PI * unit(random);
+
+    glm::vec3 center = (model.boundsMin + model.boundsMax) * 0.5f;
+
+    glm::mat4 placement = glm::translate(glm::mat4(1.0f), position);
+    placement = glm::rotate(placement, angle, glm::normalize(axis));
+    placement = glm::scale(placement, glm::vec3(scale));
+    return glm::translate(placement, -center);
+}
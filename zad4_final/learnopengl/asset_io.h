@@ -0,0 +1,93 @@
+#ifndef ASSET_IO_H
+#define ASSET_IO_H
+
+#include <assimp/IOStream.hpp>
+#include <assimp/IOSystem.hpp>
+
+#include <learnopengl/filesystem.h>
+
+#include <string>
+#include <cstring>
+#include <algorithm>
+
+// Assimp reads a model and the files it refers to (.mtl and the like) through FileSystem, straight
+// out of the asset archive when one is mounted. Read-only: Open with a write mode fails.
+class AssetIOStream : public Assimp::IOStream
+{
+public:
+    AssetIOStream(Asset&& asset) : asset(std::move(asset)), position(0)
+    {
+    }
+
+    size_t Read(void* buffer, size_t size, size_t count) override
+    {
+        if (size == 0)
+            return 0;
+        size_t items = std::min(count, (asset.size() - position) / size);
+        std::memcpy(buffer, asset.data() + position, items * size);
+        position += items * size;
+        return items;
+    }
+
+    size_t Write(const void*, size_t, size_t) override
+    {
+        return 0;
+    }
+
+    aiReturn Seek(size_t offset, aiOrigin origin) override
+    {
+        size_t base = origin == aiOrigin_SET ? 0 : origin == aiOrigin_CUR ? position : asset.size();
+        if (base + offset > asset.size())
+            return aiReturn_FAILURE;
+        position = base + offset;
+        return aiReturn_SUCCESS;
+    }
+
+    size_t Tell() const override
+    {
+        return position;
+    }
+
+    size_t FileSize() const override
+    {
+        return asset.size();
+    }
+
+    void Flush() override
+    {
+    }
+
+private:
+    Asset asset;
+    size_t position;
+};
+
+// hand to Importer::SetIOHandler, which takes ownership
+class AssetIOSystem : public Assimp::IOSystem
+{
+public:
+    bool Exists(const char* path) const override
+    {
+        return FileSystem::exists(path);
+    }
+
+    char getOsSeparator() const override
+    {
+        return '/';
+    }
+
+    Assimp::IOStream* Open(const char* path, const char* mode = "rb") override
+    {
+        if (std::strchr(mode, 'w') != nullptr || std::strchr(mode, 'a') != nullptr)
+            return nullptr;
+        Asset asset = FileSystem::open(path);
+        return asset.valid() ? new AssetIOStream(std::move(asset)) : nullptr;
+    }
+
+    void Close(Assimp::IOStream* stream) override
+    {
+        delete stream;
+    }
+};
+
+#endif
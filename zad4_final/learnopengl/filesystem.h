@@ -2,8 +2,110 @@
 #define FILESYSTEM_H
 
 #include <string>
+#include <vector>
+#include <unordered_map>
 #include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <climits>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
+#ifndef LOGL_ROOT_DIRECTORY
+// this project has no generated root_directory.h, the root only comes from LOGL_ROOT_PATH
+static char const * logl_root = nullptr;
+#endif
+
+// Packed asset archive, written by assetpack and mounted with FileSystem::mount:
+//   header   "APAK", version, entry count
+//   entries  ArchiveEntry per file
+//   names    the entries' paths, relative to the directory the archive was built from
+//   data     every file 16-byte aligned
+const uint32_t ARCHIVE_VERSION = 1;
+
+struct ArchiveHeader
+{
+  char magic[4];
+  uint32_t version;
+  uint32_t entryCount;
+  uint32_t reserved;
+};
+
+struct ArchiveEntry
+{
+  uint64_t nameOffset;
+  uint64_t nameLength;
+  uint64_t dataOffset;
+  uint64_t size;
+  int64_t modified;
+};
+
+// The bytes of an asset, never copied: a view into the mounted archive or a private mapping of a
+// loose file. Empty (valid() false) if the file doesn't exist.
+class Asset
+{
+public:
+  Asset() : bytes(nullptr), length(0), mapping(nullptr), mappedLength(0)
+  {
+  }
+
+  Asset(Asset&& other) : bytes(other.bytes), length(other.length), mapping(other.mapping), mappedLength(other.mappedLength)
+  {
+    other.bytes = nullptr;
+    other.mapping = nullptr;
+  }
+
+  Asset& operator=(Asset&& other)
+  {
+    if (this != &other)
+    {
+      release();
+      bytes = other.bytes;
+      length = other.length;
+      mapping = other.mapping;
+      mappedLength = other.mappedLength;
+      other.bytes = nullptr;
+      other.mapping = nullptr;
+    }
+    return *this;
+  }
+
+  ~Asset()
+  {
+    release();
+  }
+
+  bool valid() const { return bytes != nullptr; }
+  const char* data() const { return bytes; }
+  size_t size() const { return length; }
+  std::string str() const { return valid() ? std::string(bytes, length) : std::string(); }
+
+private:
+  friend class FileSystem;
+  const char* bytes;
+  size_t length;
+  void* mapping;
+  size_t mappedLength;
+
+  void release()
+  {
+    if (mapping != nullptr)
+      munmap(mapping, mappedLength);
+    bytes = nullptr;
+    mapping = nullptr;
+  }
+
+  Asset(const Asset&);
+  Asset& operator=(const Asset&);
+};
+
+// Paths of the LearnOpenGL root (getPath) and the assets. Assets are looked up in the mounted archive
+// first, relative paths naming files relative to the directory the archive was built from; a file the
+// archive doesn't have is read loose, relative to the working directory and then to the executable.
+// mount() before any other thread reads assets, lookups afterwards are read-only and thread safe.
 class FileSystem
 {
 private:
@@ -16,7 +118,209 @@ public:
     return (*pathBuilder)(path);
   }
 
+  // one spelling per file, to key caches with: the resolved absolute path if the file exists
+  // loose, otherwise the normalized path (which is also how the archive knows it)
+  static std::string canonicalPath(const std::string& path)
+  {
+    char resolved[PATH_MAX];
+    if (archiveEntry(path) == nullptr && realpath(path.c_str(), resolved) != nullptr)
+      return std::string(resolved);
+    return normalizePath(path);
+  }
+
+  // the path with "//", "./" and "dir/.." folded away
+  static std::string normalizePath(const std::string& path)
+  {
+    std::vector<std::string> parts;
+    size_t start = 0;
+    while (start <= path.size())
+    {
+      size_t end = path.find('/', start);
+      if (end == std::string::npos)
+        end = path.size();
+      std::string part = path.substr(start, end - start);
+      if (part == ".." && !parts.empty() && parts.back() != "..")
+        parts.pop_back();
+      else if (!part.empty() && part != ".")
+        parts.push_back(part);
+      start = end + 1;
+    }
+    std::string canonical = (!path.empty() && path[0] == '/') ? "/" : "";
+    for (size_t i = 0; i < parts.size(); i++)
+      canonical += (i > 0 ? "/" : "") + parts[i];
+    return canonical;
+  }
+
+  // map a packed archive; its files shadow the loose ones from now on
+  // ------------------------------------------------------------------------
+  static bool mount(const std::string& archivePath)
+  {
+    Archive& archive = getArchive();
+    int fd = ::open(archivePath.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(ArchiveHeader))
+    {
+      close(fd);
+      return false;
+    }
+    void* mapping = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+      return false;
+
+    // every offset is checked against the file, a broken archive isn't mounted at all
+    const char* bytes = (const char*)mapping;
+    size_t size = info.st_size;
+    const ArchiveHeader* header = (const ArchiveHeader*)bytes;
+    bool ok = std::memcmp(header->magic, "APAK", 4) == 0 && header->version == ARCHIVE_VERSION &&
+              sizeof(ArchiveHeader) + (size_t)header->entryCount * sizeof(ArchiveEntry) <= size;
+    const ArchiveEntry* entries = (const ArchiveEntry*)(bytes + sizeof(ArchiveHeader));
+    std::unordered_map<std::string, const ArchiveEntry*> files;
+    for (uint32_t i = 0; ok && i < header->entryCount; i++)
+    {
+      const ArchiveEntry& entry = entries[i];
+      ok = entry.nameOffset <= size && entry.nameLength <= size - entry.nameOffset &&
+           entry.dataOffset <= size && entry.size <= size - entry.dataOffset;
+      if (ok)
+        files[std::string(bytes + entry.nameOffset, entry.nameLength)] = &entry;
+    }
+    if (!ok)
+    {
+      munmap(mapping, size);
+      return false;
+    }
+
+    if (archive.mapping != nullptr)
+      munmap(archive.mapping, archive.size);
+    archive.mapping = mapping;
+    archive.size = size;
+    archive.files.swap(files);
+    char resolved[PATH_MAX];
+    std::string directory = archivePath.substr(0, archivePath.find_last_of('/') == std::string::npos ? 0 : archivePath.find_last_of('/'));
+    archive.root = realpath(directory.empty() ? "." : directory.c_str(), resolved) != nullptr ? std::string(resolved) : directory;
+    return true;
+  }
+
+  static size_t mountedFiles()
+  {
+    return getArchive().files.size();
+  }
+
+  // the bytes of an asset, see Asset
+  // ------------------------------------------------------------------------
+  static Asset open(const std::string& path)
+  {
+    Asset asset;
+    const ArchiveEntry* entry = archiveEntry(path);
+    if (entry != nullptr)
+    {
+      asset.bytes = (const char*)getArchive().mapping + entry->dataOffset;
+      asset.length = entry->size;
+      return asset;
+    }
+
+    std::string loose = loosePath(path);
+    int fd = ::open(loose.c_str(), O_RDONLY);
+    if (fd < 0)
+      return asset;
+    struct stat info;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode))
+    {
+      static const char empty[1] = { 0 };
+      asset.bytes = empty;
+      asset.length = info.st_size;
+      if (info.st_size > 0)
+      {
+        void* mapping = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED)
+        {
+          asset.mapping = mapping;
+          asset.mappedLength = info.st_size;
+          asset.bytes = (const char*)mapping;
+        }
+        else
+          asset.bytes = nullptr;
+      }
+    }
+    close(fd);
+    return asset;
+  }
+
+  static bool exists(const std::string& path)
+  {
+    struct stat info;
+    return archiveEntry(path) != nullptr || stat(loosePath(path).c_str(), &info) == 0;
+  }
+
+  // modification time (of the original file for an archived one), 0 if the file doesn't exist
+  static time_t modifiedTime(const std::string& path)
+  {
+    const ArchiveEntry* entry = archiveEntry(path);
+    if (entry != nullptr)
+      return (time_t)entry->modified;
+    struct stat info;
+    return stat(loosePath(path).c_str(), &info) == 0 ? info.st_mtime : 0;
+  }
+
+  static std::string const & executableDirectory()
+  {
+    static std::string directory = findExecutableDirectory();
+    return directory;
+  }
+
 private:
+  struct Archive
+  {
+    void* mapping;
+    size_t size;
+    std::string root;
+    std::unordered_map<std::string, const ArchiveEntry*> files;
+  };
+
+  static Archive& getArchive()
+  {
+    static Archive archive = { nullptr, 0, std::string(), std::unordered_map<std::string, const ArchiveEntry*>() };
+    return archive;
+  }
+
+  // archive names are normalized and relative to the archive's directory
+  static const ArchiveEntry* archiveEntry(const std::string& path)
+  {
+    Archive& archive = getArchive();
+    if (archive.files.empty())
+      return nullptr;
+    std::string key = normalizePath(path);
+    if (!key.empty() && key[0] == '/')
+    {
+      if (key.compare(0, archive.root.size() + 1, archive.root + "/") != 0)
+        return nullptr;
+      key = key.substr(archive.root.size() + 1);
+    }
+    std::unordered_map<std::string, const ArchiveEntry*>::const_iterator it = archive.files.find(key);
+    return it == archive.files.end() ? nullptr : it->second;
+  }
+
+  // a relative path that isn't there from the working directory may be from the executable's
+  static std::string loosePath(const std::string& path)
+  {
+    struct stat info;
+    if (path.empty() || path[0] == '/' || stat(path.c_str(), &info) == 0 || executableDirectory().empty())
+      return path;
+    return executableDirectory() + "/" + path;
+  }
+
+  static std::string findExecutableDirectory()
+  {
+    char resolved[PATH_MAX];
+    ssize_t length = readlink("/proc/self/exe", resolved, sizeof(resolved) - 1);
+    if (length <= 0)
+      return std::string();
+    std::string executable(resolved, length);
+    return executable.substr(0, executable.find_last_of('/'));
+  }
+
   static std::string const & getRoot()
   {
     static char const * envRoot = getenv("LOGL_ROOT_PATH");
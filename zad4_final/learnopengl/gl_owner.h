@@ -0,0 +1,27 @@
+#ifndef GL_OWNER_H
+#define GL_OWNER_H
+
+#include <GLFW/glfw3.h>
+
+// Base of the classes that own GL objects. They can't be copied, a copy would delete the objects
+// twice. Their destructors delete the objects only while glReleasable(): at exit the window can go
+// before them, and with its context everything in it, so there is nothing left to delete and no
+// context to call GL in.
+class GLOwner
+{
+protected:
+    GLOwner()
+    {
+    }
+
+    static bool glReleasable()
+    {
+        return glfwGetCurrentContext() != nullptr;
+    }
+
+private:
+    GLOwner(const GLOwner&);
+    GLOwner& operator=(const GLOwner&);
+};
+
+#endif
@@ -0,0 +1,513 @@
+#ifndef MATERIALS_H
+#define MATERIALS_H
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include <learnopengl/shader.h>
+#include <learnopengl/gl_owner.h>
+#include <learnopengl/texture_cache.h>
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <cstring>
+
+// Textures of many materials packed into a few GL_TEXTURE_2D_ARRAYs, one per texture size, and a
+// material table in a uniform buffer. A material is four texture references (diffuse, specular,
+// normal, height), each (array << 16 | layer) or -1, so a draw only needs its material index
+// (vertex attribute 6, see MeshBuffer) and many meshes with different textures can share one draw.
+// Sampler units and the uniform block binding are resolved once per shader in bindSamplers().
+// Textures and materials are added while loading (no GL needed, so any thread may do it), upload()
+// creates the GL objects once, or uploadStep() does it a slice at a time: the material table first,
+// then the precomputed mip levels (see mip_chain.h) through a pixel buffer object, coarsest first,
+// so the textures can be sampled (blurry) right away and sharpen as the finer levels arrive.
+// Arrays whose every layer comes with a BC3 chain are stored compressed where the driver has S3TC.
+// A texture another library already has on the GPU (same FileSystem::canonicalPath) is sampled from
+// that library's array instead of being decoded and uploaded again; arrays are held by shared_ptr,
+// so one stays alive as long as any library samples it.
+class MaterialLibrary : private GLOwner
+{
+public:
+    static const unsigned int MAX_ARRAYS = 4;
+    static const unsigned int MAX_MATERIALS = 256;
+    // texture units of the arrays: FIRST_UNIT .. FIRST_UNIT + MAX_ARRAYS - 1
+    static const unsigned int FIRST_UNIT = 4;
+
+    MaterialLibrary(unsigned int materialsBinding = 1) : binding(materialsBinding), ubo(0), pbo(0), uploadedBytes(0),
+                                                          uploadBegun(false), published(false), nextWork(0), drawableWork(0),
+                                                          compressedLayers(0), borrowedTextures(0)
+    {
+    }
+
+    ~MaterialLibrary()
+    {
+        if (!uploadBegun || !glReleasable())
+            return;
+        if (ubo != 0)
+            glDeleteBuffers(1, &ubo);
+        if (pbo != 0)
+            glDeleteBuffers(1, &pbo);
+    }
+
+    // the image (decoded through the TextureCache, only its BC3 chain if it has one and the driver
+    // takes S3TC) of a file, once per file; returns its handle or -1 if it can't be read. Nothing is
+    // decoded for a file that is already drawable on the GPU
+    // ------------------------------------------------------------------------
+    int addTexture(const std::string &path)
+    {
+        std::string key = FileSystem::canonicalPath(path);
+        std::unordered_map<std::string, int>::iterator it = handles.find(key);
+        if (it != handles.end())
+            return it->second;
+
+        std::shared_ptr<const CachedImage> image;
+        if (!isResident(key))
+        {
+            image = TextureCache::instance().acquire(key, !GLEW_EXT_texture_compression_s3tc);
+            if (!image)
+            {
+                handles[key] = -1;
+                return -1;
+            }
+        }
+        images.push_back(image);
+        keys.push_back(key);
+        handles[key] = images.size() - 1;
+        return images.size() - 1;
+    }
+
+    // returns the material index; identical materials are shared
+    // ------------------------------------------------------------------------
+    unsigned int addMaterial(int diffuse, int specular, int normal, int height)
+    {
+        Material material = { { diffuse, specular, normal, height } };
+        for (unsigned int i = 0; i < materials.size(); i++)
+            if (std::equal(material.textures, material.textures + 4, materials[i].textures))
+                return i;
+        if (materials.size() == MAX_MATERIALS)
+        {
+            std::cout << "MaterialLibrary: more than " << MAX_MATERIALS << " materials, using material 0" << std::endl;
+            return 0;
+        }
+        materials.push_back(material);
+        return materials.size() - 1;
+    }
+
+    unsigned int materialCount() const
+    {
+        return materials.size();
+    }
+
+    // the library can be drawn with: the material table and at least the coarsest mip level of every texture
+    bool uploaded() const
+    {
+        return ubo != 0 && nextWork >= drawableWork;
+    }
+
+    // every mip level is on the GPU
+    bool complete() const
+    {
+        return uploadBegun && nextWork == work.size();
+    }
+
+    // group the images by size into arrays and upload them with the material table
+    // ------------------------------------------------------------------------
+    void upload()
+    {
+        uploadStep(std::numeric_limits<double>::infinity());
+    }
+
+    // upload mip levels until glfwGetTime() passes the deadline (at least one per call), coarsest first
+    // across all textures; returns true once the library can be drawn (uploaded()), later calls keep
+    // refining until complete()
+    // ------------------------------------------------------------------------
+    bool uploadStep(double deadline)
+    {
+        if (complete())
+            return true;
+        if (!uploadBegun)
+            beginUpload();
+        while (nextWork < work.size())
+        {
+            uploadLevel(nextWork++);
+            if (glfwGetTime() >= deadline)
+                break;
+        }
+        if (uploaded() && !published)
+            publish();
+        if (complete())
+            finishUpload();
+        return uploaded();
+    }
+
+    // point the shader's materialArrays[] samplers and Materials block at the library, once per shader
+    // ------------------------------------------------------------------------
+    void bindSamplers(Shader &shader) const
+    {
+        shader.use();
+        for (unsigned int i = 0; i < MAX_ARRAYS; i++)
+            shader.setInt("materialArrays[" + std::to_string(i) + "]", FIRST_UNIT + i);
+        shader.bindUniformBlock("Materials", binding);
+    }
+
+    // bind the arrays and the material table for drawing
+    // ------------------------------------------------------------------------
+    void bind() const
+    {
+        for (unsigned int i = 0; i < MAX_ARRAYS; i++)
+        {
+            glActiveTexture(GL_TEXTURE0 + FIRST_UNIT + i);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, arrays[i] ? arrays[i]->id : 0);
+        }
+        glActiveTexture(GL_TEXTURE0);
+        glBindBufferBase(GL_UNIFORM_BUFFER, binding, ubo);
+    }
+
+private:
+    struct Material
+    {
+        int textures[4];
+    };
+
+    // a GL texture array, deleted with the last library that samples it
+    struct ArrayObject : private GLOwner
+    {
+        GLuint id;
+
+        ArrayObject() : id(0)
+        {
+            glGenTextures(1, &id);
+        }
+
+        ~ArrayObject()
+        {
+            if (glReleasable())
+                glDeleteTextures(1, &id);
+        }
+    };
+
+    // where an uploaded image lives, by canonical path, for every library of the process; entered
+    // once its library has uploaded() (the coarsest level of every layer is in), so it can be drawn
+    struct Resident
+    {
+        std::weak_ptr<ArrayObject> array;
+        int layer;
+    };
+
+    static std::mutex &residentMutex()
+    {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    static std::unordered_map<std::string, Resident> &residents()
+    {
+        static std::unordered_map<std::string, Resident> map;
+        return map;
+    }
+
+    // any thread; only checks the weak reference, an array must not be freed off the GL thread
+    static bool isResident(const std::string &key)
+    {
+        std::lock_guard<std::mutex> lock(residentMutex());
+        std::unordered_map<std::string, Resident>::const_iterator it = residents().find(key);
+        return it != residents().end() && !it->second.array.expired();
+    }
+
+    unsigned int binding;
+    GLuint ubo;
+    GLuint pbo;
+    std::shared_ptr<ArrayObject> arrays[MAX_ARRAYS];
+    size_t uploadedBytes;
+    // held until uploaded, the cache shares them with other libraries meanwhile; null for an image
+    // that was already resident when it was added
+    std::vector<std::shared_ptr<const CachedImage> > images;
+    // canonical path of every image
+    std::vector<std::string> keys;
+    std::vector<Material> materials;
+    std::unordered_map<std::string, int> handles;
+
+    struct TextureArray
+    {
+        int width;
+        int height;
+        int layers;
+        // 0 for an array borrowed from another library, nothing is uploaded to it
+        int levels;
+        // every layer has a BC3 chain of the array's size and the driver takes S3TC
+        bool compressed;
+    };
+
+    // upload state: the arrays, the reference of every image and the (image, level) uploads in order,
+    // all levels L-1 of every array first, then all levels L-2, ...; the first drawableWork of them
+    // are the coarsest level of every array
+    bool uploadBegun;
+    // this library's layers are in residents()
+    bool published;
+    std::vector<TextureArray> arrayInfo;
+    std::vector<int> references;
+    std::vector<std::pair<size_t, int> > work;
+    size_t nextWork;
+    size_t drawableWork;
+    size_t compressedLayers;
+    size_t borrowedTextures;
+
+    // decide the arrays, allocate their storage and the material table
+    void beginUpload()
+    {
+        uploadBegun = true;
+
+        // images some other library already has drawable are sampled from its arrays, up to
+        // MAX_ARRAYS - 1 of them so a slot is left for the images that have to be uploaded here
+        references.assign(images.size(), -1);
+        size_t borrowed = 0;
+        {
+            std::lock_guard<std::mutex> lock(residentMutex());
+            for (size_t i = 0; i < images.size(); i++)
+            {
+                std::unordered_map<std::string, Resident>::iterator it = residents().find(keys[i]);
+                if (it == residents().end())
+                    continue;
+                std::shared_ptr<ArrayObject> array = it->second.array.lock();
+                if (!array)
+                {
+                    residents().erase(it);
+                    continue;
+                }
+                size_t a = std::find(arrays, arrays + borrowed, array) - arrays;
+                if (a == borrowed)
+                {
+                    if (borrowed == MAX_ARRAYS - 1)
+                        continue;
+                    arrays[borrowed++] = array;
+                }
+                references[i] = ((int)a << 16) | it->second.layer;
+                borrowedTextures++;
+            }
+        }
+        // the rest is uploaded here; an image skipped in addTexture whose array is gone by now (or
+        // didn't get a slot) is decoded after all
+        std::vector<size_t> own;
+        for (size_t i = 0; i < images.size(); i++)
+        {
+            if (references[i] >= 0)
+                continue;
+            if (!images[i])
+                images[i] = TextureCache::instance().acquire(keys[i], !GLEW_EXT_texture_compression_s3tc);
+            if (images[i])
+                own.push_back(i);
+        }
+
+        // the most used sizes get their own array, images of any other size are resized into the first one
+        std::vector<std::pair<size_t, std::pair<int, int> > > sizes;
+        for (size_t i : own)
+        {
+            std::pair<int, int> size(images[i]->width, images[i]->height);
+            bool found = false;
+            for (std::pair<size_t, std::pair<int, int> > &entry : sizes)
+                if (entry.second == size)
+                {
+                    entry.first++;
+                    found = true;
+                }
+            if (!found)
+                sizes.push_back(std::make_pair((size_t)1, size));
+        }
+        std::stable_sort(sizes.begin(), sizes.end(),
+                         [](const std::pair<size_t, std::pair<int, int> > &a, const std::pair<size_t, std::pair<int, int> > &b) { return a.first > b.first; });
+        if (sizes.size() > MAX_ARRAYS - borrowed)
+            sizes.resize(MAX_ARRAYS - borrowed);
+
+        // the borrowed arrays keep the first slots
+        arrayInfo.resize(borrowed + sizes.size());
+        for (size_t a = 0; a < arrayInfo.size(); a++)
+        {
+            arrayInfo[a].width = a < borrowed ? 0 : sizes[a - borrowed].second.first;
+            arrayInfo[a].height = a < borrowed ? 0 : sizes[a - borrowed].second.second;
+            arrayInfo[a].layers = 0;
+            arrayInfo[a].levels = a < borrowed ? 0 : mipLevelCount(arrayInfo[a].width, arrayInfo[a].height);
+            arrayInfo[a].compressed = a >= borrowed && GLEW_EXT_texture_compression_s3tc;
+        }
+
+        // texture reference of every image uploaded here
+        for (size_t i : own)
+        {
+            size_t array = borrowed;
+            for (size_t a = 0; a < sizes.size(); a++)
+                if (sizes[a].second == std::make_pair(images[i]->width, images[i]->height))
+                    array = borrowed + a;
+            references[i] = ((int)array << 16) | arrayInfo[array].layers++;
+            if (images[i]->compressed.empty() || images[i]->width != arrayInfo[array].width || images[i]->height != arrayInfo[array].height)
+                arrayInfo[array].compressed = false;
+        }
+        // an array that ends up uncompressed needs the RGBA8 chain of every layer, which an image with
+        // a BC3 chain was read without
+        for (size_t i : own)
+        {
+            if (arrayInfo[references[i] >> 16].compressed || !images[i]->levels.empty())
+                continue;
+            std::shared_ptr<const CachedImage> image = TextureCache::instance().acquire(keys[i], true);
+            if (image)
+                images[i] = image;
+        }
+
+        // storage for every level; sampling is limited to the levels uploaded so far with the base level
+        for (size_t a = borrowed; a < arrayInfo.size(); a++)
+        {
+            const TextureArray &info = arrayInfo[a];
+            arrays[a] = std::make_shared<ArrayObject>();
+            glBindTexture(GL_TEXTURE_2D_ARRAY, arrays[a]->id);
+            for (int level = 0; level < info.levels; level++)
+            {
+                int width = std::max(1, info.width >> level);
+                int height = std::max(1, info.height >> level);
+                if (info.compressed)
+                    glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, width, height, info.layers, 0,
+                                           mipLevelSize(MIP_BC3, width, height) * info.layers, NULL);
+                else
+                    glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA8, width, height, info.layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+            }
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, info.levels - 1);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, info.levels - 1);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            if (info.compressed)
+                compressedLayers += info.layers;
+        }
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        glGenBuffers(1, &pbo);
+
+        // coarsest first: step s uploads level (levels - 1 - s) of every array that has one
+        int steps = 0;
+        for (const TextureArray &info : arrayInfo)
+            steps = std::max(steps, info.levels);
+        for (int step = 0; step < steps; step++)
+        {
+            for (size_t a = 0; a < arrayInfo.size(); a++)
+            {
+                int level = arrayInfo[a].levels - 1 - step;
+                if (level < 0)
+                    continue;
+                for (size_t i : own)
+                    if ((size_t)(references[i] >> 16) == a)
+                        work.push_back(std::make_pair(i, level));
+            }
+            if (step == 0)
+                drawableWork = work.size();
+        }
+
+        // material table, std140 ivec4 per material, padded to the size of the shader's block
+        std::vector<int> table(4 * MAX_MATERIALS, -1);
+        for (size_t m = 0; m < materials.size(); m++)
+            for (int k = 0; k < 4; k++)
+                table[4 * m + k] = materials[m].textures[k] >= 0 ? references[materials[m].textures[k]] : -1;
+        glGenBuffers(1, &ubo);
+        glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+        glBufferData(GL_UNIFORM_BUFFER, table.size() * sizeof(int), table.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    // one level of one layer through the pixel buffer object; the buffer is orphaned first, so the
+    // copy of the previous level the driver may still be reading from doesn't stall the map. Once a
+    // level is in for every layer of an array, the array's base level moves down to it.
+    void uploadLevel(size_t index)
+    {
+        size_t i = work[index].first;
+        int level = work[index].second;
+        int array = references[i] >> 16;
+        const TextureArray &info = arrayInfo[array];
+        int width = std::max(1, info.width >> level);
+        int height = std::max(1, info.height >> level);
+        size_t bytes = mipLevelSize(info.compressed ? MIP_BC3 : MIP_RGBA8, width, height);
+
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+        unsigned char* dst = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes,
+                                                              GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        // the map can fail (out of memory), the level then goes up from client memory
+        std::vector<unsigned char> unmapped;
+        const void* pixels = (void*)0;
+        if (dst == nullptr)
+        {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            unmapped.resize(bytes);
+            dst = unmapped.data();
+            pixels = dst;
+        }
+        if (info.compressed)
+            std::memcpy(dst, images[i]->compressed[level].data.data(), bytes);
+        else if (images[i]->levels.empty())
+            std::memset(dst, 0xff, bytes);   // the RGBA8 chain couldn't be read after all: white
+        else if (images[i]->width == info.width && images[i]->height == info.height)
+            std::memcpy(dst, images[i]->levels[level].data.data(), bytes);
+        else
+            resize(images[i]->levels[0], width, height, dst);
+        if (unmapped.empty())
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+        glBindTexture(GL_TEXTURE_2D_ARRAY, arrays[array]->id);
+        if (info.compressed)
+            glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, references[i] & 0xffff, width, height, 1,
+                                      GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, bytes, pixels);
+        else
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, references[i] & 0xffff, width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+        bool levelDone = index + 1 == work.size() || (references[work[index + 1].first] >> 16) != array || work[index + 1].second != level;
+        if (levelDone)
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, level);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        uploadedBytes += bytes;
+    }
+
+    // the layers uploaded here can be sampled, let later libraries borrow them
+    void publish()
+    {
+        published = true;
+        std::lock_guard<std::mutex> lock(residentMutex());
+        for (size_t i = 0; i < images.size(); i++)
+        {
+            if (references[i] < 0 || arrayInfo[references[i] >> 16].levels == 0)
+                continue;
+            std::unordered_map<std::string, Resident>::iterator it = residents().find(keys[i]);
+            if (it != residents().end() && !it->second.array.expired())
+                continue;
+            Resident resident = { arrays[references[i] >> 16], references[i] & 0xffff };
+            residents()[keys[i]] = resident;
+        }
+    }
+
+    // everything is on the GPU, let go of the images
+    void finishUpload()
+    {
+        glDeleteBuffers(1, &pbo);
+        pbo = 0;
+
+        std::cout << "materials: " << materials.size() << " materials, " << images.size() << " textures in "
+                  << arrayInfo.size() << " texture arrays (" << compressedLayers << " layers BC3, " << borrowedTextures
+                  << " textures sampled from other libraries' arrays), " << uploadedBytes / 1024 << "KB with mip chains" << std::endl;
+        std::vector<std::shared_ptr<const CachedImage> >().swap(images);
+    }
+
+    // nearest neighbour from the full image, only for images whose size didn't get an array of its own
+    static void resize(const MipLevel &image, int width, int height, unsigned char* resized)
+    {
+        for (int y = 0; y < height; y++)
+            for (int x = 0; x < width; x++)
+            {
+                int sx = x * image.width / width;
+                int sy = y * image.height / height;
+                std::copy(&image.data[((size_t)sy * image.width + sx) * 4], &image.data[((size_t)sy * image.width + sx) * 4] + 4,
+                          &resized[((size_t)y * width + x) * 4]);
+            }
+    }
+};
+
+#endif
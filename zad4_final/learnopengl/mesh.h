@@ -1,15 +1,18 @@
 #ifndef MESH_H
 #define MESH_H
 
-#include <glad/glad.h> // holds all OpenGL type declarations
+#include <GL/glew.h> // holds all OpenGL type declarations
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
 #include <learnopengl/shader.h>
+#include <learnopengl/mesh_optimizer.h>
+#include <learnopengl/packed_vertex.h>
 
 #include <string>
 #include <vector>
+#include <cfloat>
 using namespace std;
 
 struct Vertex {
@@ -38,63 +41,86 @@ public:
     vector<unsigned int> indices;
     vector<Texture>      textures;
     unsigned int VAO;
-
-    // constructor
-    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
+    // GL_UNSIGNED_SHORT when the mesh has at most 65536 vertices
+    GLenum indexType;
+    MeshOptimizationReport optimization;
+    // the GPU copy is PackedVertex, positions quantized to these bounds
+    glm::vec3 boundsMin;
+    glm::vec3 boundsExtent;
+    // index into a MaterialLibrary, attribute 6 (see Model)
+    unsigned int material;
+
+    // constructor; without createBuffers the mesh is meant to be added to a MeshBuffer (see Model)
+    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures, bool createBuffers = true)
+        : VAO(0), material(0), VBO(0), EBO(0)
     {
         this->vertices = vertices;
         this->indices = indices;
         this->textures = textures;
 
+        // reorder for the vertex cache and overdraw, renumber vertices in fetch order
+        size_t vertexCount = this->vertices.size();
+        if (!this->indices.empty())
+        {
+            optimization = optimizeMesh(this->indices, &this->vertices[0], vertexCount, sizeof(Vertex), offsetof(Vertex, Position));
+            this->vertices.resize(vertexCount);
+        }
+
         // now that we have all the required data, set the vertex buffers and its attribute pointers.
-        setupMesh();
+        if (createBuffers)
+            setupMesh();
+        else
+            computeBounds();
     }
 
-    // render the mesh
-    void Draw(Shader &shader) 
+    // render the mesh; its textures are sampled through the material (see MaterialLibrary)
+    void Draw()
     {
-        // bind appropriate textures
-        unsigned int diffuseNr  = 1;
-        unsigned int specularNr = 1;
-        unsigned int normalNr   = 1;
-        unsigned int heightNr   = 1;
-        for(unsigned int i = 0; i < textures.size(); i++)
-        {
-            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
-            // retrieve texture number (the N in diffuse_textureN)
-            string number;
-            string name = textures[i].type;
-            if(name == "texture_diffuse")
-                number = std::to_string(diffuseNr++);
-            else if(name == "texture_specular")
-                number = std::to_string(specularNr++); // transfer unsigned int to stream
-            else if(name == "texture_normal")
-                number = std::to_string(normalNr++); // transfer unsigned int to stream
-             else if(name == "texture_height")
-                number = std::to_string(heightNr++); // transfer unsigned int to stream
-
-            // now set the sampler to the correct texture unit
-            glUniform1i(glGetUniformLocation(shader.ID, (name + number).c_str()), i);
-            // and finally bind the texture
-            glBindTexture(GL_TEXTURE_2D, textures[i].id);
-        }
-        
+        // the bounds and the material are per draw, a constant value of attributes 4, 5 and 6
+        glVertexAttrib3fv(4, &boundsMin[0]);
+        glVertexAttrib3fv(5, &boundsExtent[0]);
+        glVertexAttribI1ui(6, material);
+
         // draw mesh
         glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+        glDrawElements(GL_TRIANGLES, indices.size(), indexType, 0);
         glBindVertexArray(0);
+    }
 
-        // always good practice to set everything back to defaults once configured.
-        glActiveTexture(GL_TEXTURE0);
+    // the GPU form of the vertices, quantized against boundsMin/boundsExtent
+    vector<PackedVertex> packVertices() const
+    {
+        vector<PackedVertex> packed(vertices.size());
+        for (unsigned int i = 0; i < vertices.size(); i++)
+            packed[i] = packVertex(vertices[i].Position, vertices[i].Normal, vertices[i].TexCoords,
+                                   vertices[i].Tangent, vertices[i].Bitangent, boundsMin, boundsExtent);
+        return packed;
     }
 
 private:
     // render data 
     unsigned int VBO, EBO;
+    // positions are quantized against the mesh bounds
+    void computeBounds()
+    {
+        glm::vec3 boundsMax(-FLT_MAX);
+        boundsMin = glm::vec3(FLT_MAX);
+        for (unsigned int i = 0; i < vertices.size(); i++)
+        {
+            boundsMin = glm::min(boundsMin, vertices[i].Position);
+            boundsMax = glm::max(boundsMax, vertices[i].Position);
+        }
+        boundsExtent = vertices.empty() ? glm::vec3(0.0f) : boundsMax - boundsMin;
+        indexType = vertices.size() <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    }
 
     // initializes all the buffer objects/arrays
     void setupMesh()
     {
+        // quantize against the mesh bounds and pack normal, uv and tangent frame
+        computeBounds();
+        vector<PackedVertex> packed = packVertices();
+
         // create buffers/arrays
         glGenVertexArrays(1, &VAO);
         glGenBuffers(1, &VBO);
@@ -103,30 +129,14 @@ private:
         glBindVertexArray(VAO);
         // load data into vertex buffers
         glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        // A great thing about structs is that their memory layout is sequential for all its items.
-        // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
-        // again translates to 3/2 floats which translates to a byte array.
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);  
+        glBufferData(GL_ARRAY_BUFFER, packed.size() * sizeof(PackedVertex), packed.data(), GL_STATIC_DRAW);
 
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
-
-        // set the vertex attribute pointers
-        // vertex Positions
-        glEnableVertexAttribArray(0);	
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-        // vertex normals
-        glEnableVertexAttribArray(1);	
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
-        // vertex texture coords
-        glEnableVertexAttribArray(2);	
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
-        // vertex tangent
-        glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
-        // vertex bitangent
-        glEnableVertexAttribArray(4);
-        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
+        indexType = uploadIndices(indices, vertices.size());
+
+        // set the vertex attribute pointers: packed position, normal, texture coords and tangent,
+        // the bitangent is rebuilt in the shader (packed_vertex.glsl)
+        setupPackedVertexAttributes();
 
         glBindVertexArray(0);
     }
@@ -0,0 +1,220 @@
+#ifndef MESH_BUFFER_H
+#define MESH_BUFFER_H
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+#include <learnopengl/gl_owner.h>
+
+#include <learnopengl/packed_vertex.h>
+
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+
+// layout of the commands in GL_DRAW_INDIRECT_BUFFER
+struct DrawElementsIndirectCommand
+{
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+// One vertex buffer, one index buffer and one VAO that many meshes are suballocated from.
+// Every mesh becomes a range with its own first index and base vertex, plus per-draw data
+// (the bounds its positions are quantized to and its material index) read as instanced
+// attributes 4, 5 and 6. With
+// multi-draw indirect any run of ranges goes out as one glMultiDrawElementsIndirect, whose
+// baseInstance selects the per-draw data; without it the ranges are drawn one by one with
+// glDrawElementsBaseVertex and the per-draw data set as constant attributes.
+// Meshes are added first, then upload() creates the GL objects once; nothing can be added after.
+class MeshBuffer : private GLOwner
+{
+public:
+    struct Range
+    {
+        GLuint firstIndex;
+        GLuint indexCount;
+        GLint baseVertex;
+        GLuint vertexCount;
+    };
+
+    // per-draw data, one entry per range
+    struct DrawData
+    {
+        glm::vec3 boundsMin;
+        glm::vec3 boundsExtent;
+        GLuint material;
+    };
+
+    std::vector<Range> ranges;
+
+    MeshBuffer() : VAO(0), VBO(0), EBO(0), drawDataBuffer(0), indirectBuffer(0), indexType(GL_UNSIGNED_INT),
+                   multiDrawIndirect(false), maxRangeVertices(0)
+    {
+    }
+
+    ~MeshBuffer()
+    {
+        if (VAO == 0 || !glReleasable())
+            return;
+        glDeleteVertexArrays(1, &VAO);
+        glDeleteBuffers(1, &VBO);
+        glDeleteBuffers(1, &EBO);
+        glDeleteBuffers(1, &drawDataBuffer);
+        if (indirectBuffer != 0)
+            glDeleteBuffers(1, &indirectBuffer);
+    }
+
+    // append a mesh, indices relative to its own vertices; returns the range index
+    // ------------------------------------------------------------------------
+    size_t add(const std::vector<PackedVertex> &meshVertices, const std::vector<unsigned int> &meshIndices,
+               glm::vec3 boundsMin, glm::vec3 boundsExtent, unsigned int material = 0)
+    {
+        return add(meshVertices.data(), meshVertices.size(), meshIndices.data(), meshIndices.size(), boundsMin, boundsExtent, material);
+    }
+
+    // the same from raw arrays, e.g. a mapped ModelCacheFile
+    size_t add(const PackedVertex* meshVertices, size_t vertexCount, const unsigned int* meshIndices, size_t indexCount,
+               glm::vec3 boundsMin, glm::vec3 boundsExtent, unsigned int material = 0)
+    {
+        Range range;
+        range.firstIndex = indices.size();
+        range.indexCount = indexCount;
+        range.baseVertex = vertices.size();
+        range.vertexCount = vertexCount;
+        ranges.push_back(range);
+        maxRangeVertices = std::max<size_t>(maxRangeVertices, vertexCount);
+
+        vertices.insert(vertices.end(), meshVertices, meshVertices + vertexCount);
+        indices.insert(indices.end(), meshIndices, meshIndices + indexCount);
+        DrawData data = { boundsMin, boundsExtent, material };
+        drawData.push_back(data);
+        return ranges.size() - 1;
+    }
+
+    bool uploaded() const
+    {
+        return VAO != 0;
+    }
+
+    // create the buffers; indices are 16-bit when no single range has more than 65536 vertices
+    // ------------------------------------------------------------------------
+    void upload()
+    {
+        multiDrawIndirect = GLEW_VERSION_4_3 || (GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance);
+
+        glGenVertexArrays(1, &VAO);
+        glBindVertexArray(VAO);
+
+        glGenBuffers(1, &VBO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(PackedVertex), vertices.data(), GL_STATIC_DRAW);
+        setupPackedVertexAttributes();
+
+        glGenBuffers(1, &EBO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        if (maxRangeVertices <= 65536)
+        {
+            std::vector<unsigned short> shortIndices(indices.begin(), indices.end());
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, shortIndices.size() * sizeof(unsigned short), shortIndices.data(), GL_STATIC_DRAW);
+            indexType = GL_UNSIGNED_SHORT;
+        }
+        else
+        {
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+            indexType = GL_UNSIGNED_INT;
+        }
+
+        // per-draw data, one step per instance, so baseInstance picks the draw's entry
+        glGenBuffers(1, &drawDataBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, drawDataBuffer);
+        glBufferData(GL_ARRAY_BUFFER, drawData.size() * sizeof(DrawData), drawData.data(), GL_STATIC_DRAW);
+        if (multiDrawIndirect)
+        {
+            glEnableVertexAttribArray(4);
+            glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(DrawData), (void*)offsetof(DrawData, boundsMin));
+            glVertexAttribDivisor(4, 1);
+            glEnableVertexAttribArray(5);
+            glVertexAttribPointer(5, 3, GL_FLOAT, GL_FALSE, sizeof(DrawData), (void*)offsetof(DrawData, boundsExtent));
+            glVertexAttribDivisor(5, 1);
+            glEnableVertexAttribArray(6);
+            glVertexAttribIPointer(6, 1, GL_UNSIGNED_INT, sizeof(DrawData), (void*)offsetof(DrawData, material));
+            glVertexAttribDivisor(6, 1);
+
+            std::vector<DrawElementsIndirectCommand> commands(ranges.size());
+            for (size_t i = 0; i < ranges.size(); i++)
+            {
+                commands[i].count = ranges[i].indexCount;
+                commands[i].instanceCount = 1;
+                commands[i].firstIndex = ranges[i].firstIndex;
+                commands[i].baseVertex = ranges[i].baseVertex;
+                commands[i].baseInstance = i;
+            }
+            glGenBuffers(1, &indirectBuffer);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+            glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data(), GL_STATIC_DRAW);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        }
+
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        // the GPU has its copy now
+        std::vector<PackedVertex>().swap(vertices);
+        std::vector<unsigned int>().swap(indices);
+    }
+
+    // draw ranges [first, first + count); the VAO has to be bound (bind())
+    // ------------------------------------------------------------------------
+    void draw(size_t first, size_t count) const
+    {
+        if (count == 0)
+            return;
+
+        if (multiDrawIndirect)
+        {
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+            glMultiDrawElementsIndirect(GL_TRIANGLES, indexType, (void*)(first * sizeof(DrawElementsIndirectCommand)), count, 0);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+            return;
+        }
+
+        size_t indexSize = indexType == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+        for (size_t i = first; i < first + count; i++)
+        {
+            glVertexAttrib3fv(4, &drawData[i].boundsMin[0]);
+            glVertexAttrib3fv(5, &drawData[i].boundsExtent[0]);
+            glVertexAttribI1ui(6, drawData[i].material);
+            glDrawElementsBaseVertex(GL_TRIANGLES, ranges[i].indexCount, indexType,
+                                     (void*)(ranges[i].firstIndex * indexSize), ranges[i].baseVertex);
+        }
+    }
+
+    void bind() const
+    {
+        glBindVertexArray(VAO);
+    }
+
+    bool usesMultiDrawIndirect() const
+    {
+        return multiDrawIndirect;
+    }
+
+private:
+    GLuint VAO, VBO, EBO;
+    GLuint drawDataBuffer;
+    GLuint indirectBuffer;
+    GLenum indexType;
+    bool multiDrawIndirect;
+    size_t maxRangeVertices;
+
+    // staging until upload(); drawData is kept for the fallback path
+    std::vector<PackedVertex> vertices;
+    std::vector<unsigned int> indices;
+    std::vector<DrawData> drawData;
+};
+
+#endif
@@ -0,0 +1,344 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <cmath>
+#include <cstring>
+#include <cstddef>
+#include <string>
+
+// On-load optimization of indexed triangle meshes, run once before upload:
+//  1. vertex cache order: triangles reordered with Forsyth's linear-speed algorithm, so that
+//     vertices are reused while they are still in the post-transform cache
+//  2. overdraw order: the cache-ordered triangles are cut into clusters at cache boundaries and the
+//     clusters sorted outside-facing first, as long as that costs at most a few percent of ACMR
+//  3. vertex fetch order: vertices renumbered in first-use order, unused vertices dropped
+//  4. 16-bit indices whenever the mesh has at most 65536 vertices
+// ACMR (average cache miss ratio) is post-transform cache misses per triangle, 0.5 is the best a
+// large regular mesh can do, 3 means no reuse at all.
+
+struct MeshOptimizationReport
+{
+    size_t triangles;
+    size_t verticesBefore;
+    size_t verticesAfter;
+    // summed over triangles, so reports of several meshes can be merged
+    double missesBefore;
+    double missesAfter;
+
+    MeshOptimizationReport() : triangles(0), verticesBefore(0), verticesAfter(0), missesBefore(0.0), missesAfter(0.0) {}
+
+    float acmrBefore() const
+    {
+        return triangles > 0 ? (float)(missesBefore / triangles) : 0.0f;
+    }
+
+    float acmrAfter() const
+    {
+        return triangles > 0 ? (float)(missesAfter / triangles) : 0.0f;
+    }
+
+    void merge(const MeshOptimizationReport &other)
+    {
+        triangles += other.triangles;
+        verticesBefore += other.verticesBefore;
+        verticesAfter += other.verticesAfter;
+        missesBefore += other.missesBefore;
+        missesAfter += other.missesAfter;
+    }
+
+    void print(const std::string &name) const
+    {
+        std::cout << name << ": " << triangles << " triangles, ACMR " << acmrBefore() << " -> " << acmrAfter()
+                  << ", vertices " << verticesBefore << " -> " << verticesAfter
+                  << (verticesAfter <= 65536 ? ", 16-bit indices" : ", 32-bit indices") << std::endl;
+    }
+};
+
+// misses per triangle of a FIFO post-transform cache with cacheSize entries
+// ---------------------------------------------------------------------------------------------------------
+inline float vertexCacheACMR(const std::vector<unsigned int> &indices, size_t vertexCount, unsigned int cacheSize = 16)
+{
+    if (indices.size() < 3)
+        return 0.0f;
+
+    // a vertex is cached while fewer than cacheSize misses happened since it was loaded
+    std::vector<size_t> loadedAt(vertexCount, 0);
+    size_t time = cacheSize + 1;
+    size_t misses = 0;
+    for (unsigned int index : indices)
+    {
+        if (time - loadedAt[index] > cacheSize)
+        {
+            loadedAt[index] = time++;
+            misses++;
+        }
+    }
+    return (float)misses / (indices.size() / 3);
+}
+
+// Forsyth: repeatedly emit the best scored triangle among those using vertices in a simulated LRU cache
+// ---------------------------------------------------------------------------------------------------------
+inline void optimizeVertexCache(std::vector<unsigned int> &indices, size_t vertexCount)
+{
+    const int cacheSize = 32;
+    const size_t NONE = ~(size_t)0;
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0)
+        return;
+
+    // triangles of every vertex; the first live[v] entries are the ones not emitted yet
+    std::vector<unsigned int> live(vertexCount, 0);
+    for (unsigned int index : indices)
+        live[index]++;
+    std::vector<size_t> first(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; v++)
+        first[v + 1] = first[v] + live[v];
+    std::vector<size_t> adjacency(indices.size());
+    std::vector<size_t> filled(first.begin(), first.end() - 1);
+    for (size_t i = 0; i < indices.size(); i++)
+        adjacency[filled[indices[i]]++] = i / 3;
+
+    std::vector<int> cachePosition(vertexCount, -1);
+    auto vertexScore = [&](size_t v)
+    {
+        if (live[v] == 0)
+            return -1.0f;
+        float score = 0.0f;
+        int position = cachePosition[v];
+        if (position >= 0)
+        {
+            // the last triangle's vertices get a fixed score, so it isn't simply repeated
+            if (position < 3)
+                score = 0.75f;
+            else
+                score = std::pow(1.0f - (position - 3) * (1.0f / (cacheSize - 3)), 1.5f);
+        }
+        // vertices with few triangles left are finished off first
+        return score + 2.0f * std::pow((float)live[v], -0.5f);
+    };
+
+    std::vector<float> vertexScores(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++)
+        vertexScores[v] = vertexScore(v);
+    std::vector<float> triangleScores(triangleCount);
+    size_t best = 0;
+    for (size_t t = 0; t < triangleCount; t++)
+    {
+        triangleScores[t] = vertexScores[indices[3 * t]] + vertexScores[indices[3 * t + 1]] + vertexScores[indices[3 * t + 2]];
+        if (triangleScores[t] > triangleScores[best])
+            best = t;
+    }
+
+    std::vector<char> emitted(triangleCount, 0);
+    std::vector<unsigned int> cache, newCache;
+    std::vector<unsigned int> result;
+    result.reserve(indices.size());
+    size_t scan = 0;
+
+    while (result.size() < indices.size())
+    {
+        // nothing in the cache has triangles left: continue with the next triangle in input order
+        if (best == NONE)
+        {
+            while (emitted[scan])
+                scan++;
+            best = scan;
+        }
+
+        emitted[best] = 1;
+        for (int k = 0; k < 3; k++)
+        {
+            unsigned int v = indices[3 * best + k];
+            result.push_back(v);
+
+            size_t* triangles = &adjacency[first[v]];
+            for (unsigned int i = 0; i < live[v]; i++)
+                if (triangles[i] == best)
+                {
+                    std::swap(triangles[i], triangles[live[v] - 1]);
+                    break;
+                }
+            live[v]--;
+        }
+
+        // the emitted triangle's vertices move to the front of the cache
+        newCache.clear();
+        for (int k = 0; k < 3; k++)
+            newCache.push_back(indices[3 * best + k]);
+        for (unsigned int v : cache)
+            if (v != newCache[0] && v != newCache[1] && v != newCache[2])
+                newCache.push_back(v);
+
+        for (size_t i = 0; i < newCache.size(); i++)
+        {
+            cachePosition[newCache[i]] = i < (size_t)cacheSize ? (int)i : -1;
+            vertexScores[newCache[i]] = vertexScore(newCache[i]);
+        }
+
+        best = NONE;
+        float bestScore = -1.0f;
+        for (unsigned int v : newCache)
+            for (unsigned int i = 0; i < live[v]; i++)
+            {
+                size_t t = adjacency[first[v] + i];
+                triangleScores[t] = vertexScores[indices[3 * t]] + vertexScores[indices[3 * t + 1]] + vertexScores[indices[3 * t + 2]];
+                if (triangleScores[t] > bestScore)
+                {
+                    bestScore = triangleScores[t];
+                    best = t;
+                }
+            }
+
+        if (newCache.size() > (size_t)cacheSize)
+            newCache.resize(cacheSize);
+        cache.swap(newCache);
+    }
+
+    indices.swap(result);
+}
+
+// Cut the (cache-ordered) triangles into clusters wherever a triangle misses the cache with all three
+// vertices, then draw clusters facing away from the mesh center first, so they tend to occlude what
+// comes later. Kept only if the ACMR grows by less than threshold.
+// ---------------------------------------------------------------------------------------------------------
+inline void optimizeOverdraw(std::vector<unsigned int> &indices, const void* vertices, size_t vertexCount,
+                             size_t stride, size_t positionOffset, float threshold = 1.05f)
+{
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount < 2)
+        return;
+
+    auto position = [&](unsigned int v)
+    {
+        glm::vec3 p;
+        std::memcpy(&p[0], (const char*)vertices + v * stride + positionOffset, sizeof(glm::vec3));
+        return p;
+    };
+
+    // cluster boundaries from the same FIFO cache the ACMR uses
+    const unsigned int cacheSize = 16;
+    std::vector<size_t> clusterStart;
+    std::vector<size_t> loadedAt(vertexCount, 0);
+    size_t time = cacheSize + 1;
+    for (size_t t = 0; t < triangleCount; t++)
+    {
+        int misses = 0;
+        for (int k = 0; k < 3; k++)
+        {
+            unsigned int v = indices[3 * t + k];
+            if (time - loadedAt[v] > cacheSize)
+            {
+                loadedAt[v] = time++;
+                misses++;
+            }
+        }
+        if (t == 0 || misses == 3)
+            clusterStart.push_back(t);
+    }
+    if (clusterStart.size() < 2)
+        return;
+    clusterStart.push_back(triangleCount);
+
+    glm::vec3 meshCenter(0.0f);
+    for (size_t v = 0; v < vertexCount; v++)
+        meshCenter += position(v);
+    meshCenter = meshCenter * (1.0f / vertexCount);
+
+    // sort key: how much the cluster faces away from the center, from its area-weighted center and
+    // average normal; both are divided by the total area, so the normal is shorter the less the
+    // cluster's triangles agree on a direction
+    std::vector<std::pair<float, size_t> > clusters;
+    for (size_t c = 0; c + 1 < clusterStart.size(); c++)
+    {
+        glm::vec3 center(0.0f), normal(0.0f);
+        float area = 0.0f;
+        for (size_t t = clusterStart[c]; t < clusterStart[c + 1]; t++)
+        {
+            glm::vec3 a = position(indices[3 * t]);
+            glm::vec3 b = position(indices[3 * t + 1]);
+            glm::vec3 d = position(indices[3 * t + 2]);
+            glm::vec3 areaNormal = glm::cross(b - a, d - a);
+            float triangleArea = glm::length(areaNormal);
+            normal += areaNormal;
+            center += (a + b + d) * (triangleArea / 3.0f);
+            area += triangleArea;
+        }
+        float key = 0.0f;
+        if (area > 0.0f)
+            key = glm::dot(center * (1.0f / area) - meshCenter, normal * (1.0f / area));
+        clusters.push_back(std::make_pair(key, c));
+    }
+    std::stable_sort(clusters.begin(), clusters.end(),
+                     [](const std::pair<float, size_t> &a, const std::pair<float, size_t> &b) { return a.first > b.first; });
+
+    std::vector<unsigned int> sorted;
+    sorted.reserve(indices.size());
+    for (const std::pair<float, size_t> &cluster : clusters)
+        sorted.insert(sorted.end(), indices.begin() + 3 * clusterStart[cluster.second],
+                      indices.begin() + 3 * clusterStart[cluster.second + 1]);
+
+    if (vertexCacheACMR(sorted, vertexCount) <= threshold * vertexCacheACMR(indices, vertexCount))
+        indices.swap(sorted);
+}
+
+// renumber vertices in the order the indices first use them and drop unused ones; returns the new count
+// ---------------------------------------------------------------------------------------------------------
+inline size_t optimizeVertexFetch(std::vector<unsigned int> &indices, void* vertices, size_t vertexCount, size_t stride)
+{
+    const unsigned int UNUSED = ~0u;
+    std::vector<unsigned int> remap(vertexCount, UNUSED);
+    std::vector<char> original((const char*)vertices, (const char*)vertices + vertexCount * stride);
+
+    unsigned int next = 0;
+    for (unsigned int &index : indices)
+    {
+        if (remap[index] == UNUSED)
+        {
+            std::memcpy((char*)vertices + next * stride, &original[index * stride], stride);
+            remap[index] = next++;
+        }
+        index = remap[index];
+    }
+    return next;
+}
+
+// all of the above; vertices are interleaved with the given stride and a vec3 position at positionOffset
+// ---------------------------------------------------------------------------------------------------------
+inline MeshOptimizationReport optimizeMesh(std::vector<unsigned int> &indices, void* vertices, size_t &vertexCount,
+                                           size_t stride, size_t positionOffset)
+{
+    MeshOptimizationReport report;
+    report.triangles = indices.size() / 3;
+    report.verticesBefore = vertexCount;
+    report.missesBefore = (double)vertexCacheACMR(indices, vertexCount) * report.triangles;
+
+    optimizeVertexCache(indices, vertexCount);
+    optimizeOverdraw(indices, vertices, vertexCount, stride, positionOffset);
+    vertexCount = optimizeVertexFetch(indices, vertices, vertexCount, stride);
+
+    report.verticesAfter = vertexCount;
+    report.missesAfter = (double)vertexCacheACMR(indices, vertexCount) * report.triangles;
+    return report;
+}
+
+// upload to the bound GL_ELEMENT_ARRAY_BUFFER, 16-bit when every index fits; returns the index type
+// ---------------------------------------------------------------------------------------------------------
+inline GLenum uploadIndices(const std::vector<unsigned int> &indices, size_t vertexCount)
+{
+    if (vertexCount <= 65536)
+    {
+        std::vector<unsigned short> shortIndices(indices.begin(), indices.end());
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, shortIndices.size() * sizeof(unsigned short), shortIndices.data(), GL_STATIC_DRAW);
+        return GL_UNSIGNED_SHORT;
+    }
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+    return GL_UNSIGNED_INT;
+}
+
+#endif
@@ -0,0 +1,291 @@
+#ifndef MIP_CHAIN_H
+#define MIP_CHAIN_H
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+
+#include <learnopengl/filesystem.h>
+
+// Mip chains built once, offline by texpack (or on a worker thread when a texture has no .mips file),
+// instead of glGenerateMipmap at load time, so every driver samples the same texels.
+//
+// "<image>.mips" holds the RGBA8 chain, "<image>.bc.mips" optionally the same chain BC3 (DXT5) compressed:
+//   header       "MIPS", version, format, width, height, level count
+//   level sizes  uint32 per level
+//   levels       coarsest first, so a streaming reader has something to show after the first bytes
+// Levels in memory are finest first, levels[0] is the full image.
+
+const uint32_t MIP_FILE_VERSION = 1;
+
+enum MipFormat
+{
+    MIP_RGBA8 = 0,
+    MIP_BC3 = 1
+};
+
+struct MipLevel
+{
+    int width;
+    int height;
+    std::vector<unsigned char> data;
+};
+
+inline int mipLevelCount(int width, int height)
+{
+    int levels = 1;
+    while (width > 1 || height > 1)
+    {
+        width = std::max(1, width / 2);
+        height = std::max(1, height / 2);
+        levels++;
+    }
+    return levels;
+}
+
+// bytes of a level, BC3 stores every (partial) 4x4 block in 16 bytes
+inline size_t mipLevelSize(MipFormat format, int width, int height)
+{
+    if (format == MIP_BC3)
+        return (size_t)((width + 3) / 4) * ((height + 3) / 4) * 16;
+    return (size_t)width * height * 4;
+}
+
+// RGBA8 chain down to 1x1, every level a box filter of the one above (an odd last row or column
+// is folded into its neighbour); the texels are averaged as stored, without a gamma conversion
+// ---------------------------------------------------------------------------------------------------------
+inline std::vector<MipLevel> buildMipChain(const unsigned char* rgba, int width, int height)
+{
+    std::vector<MipLevel> levels(1);
+    levels[0].width = width;
+    levels[0].height = height;
+    levels[0].data.assign(rgba, rgba + (size_t)width * height * 4);
+
+    while (levels.back().width > 1 || levels.back().height > 1)
+    {
+        const MipLevel &above = levels.back();
+        MipLevel level;
+        level.width = std::max(1, above.width / 2);
+        level.height = std::max(1, above.height / 2);
+        level.data.resize((size_t)level.width * level.height * 4);
+        for (int y = 0; y < level.height; y++)
+            for (int x = 0; x < level.width; x++)
+            {
+                // source rows/columns of this texel, 3 of them next to an odd edge
+                int x0 = x * above.width / level.width, x1 = (x + 1) * above.width / level.width;
+                int y0 = y * above.height / level.height, y1 = (y + 1) * above.height / level.height;
+                for (int c = 0; c < 4; c++)
+                {
+                    unsigned int sum = 0;
+                    for (int sy = y0; sy < y1; sy++)
+                        for (int sx = x0; sx < x1; sx++)
+                            sum += above.data[((size_t)sy * above.width + sx) * 4 + c];
+                    unsigned int count = (x1 - x0) * (y1 - y0);
+                    level.data[((size_t)y * level.width + x) * 4 + c] = (unsigned char)((sum + count / 2) / count);
+                }
+            }
+        levels.push_back(level);
+    }
+    return levels;
+}
+
+// BC3: a BC1 colour block (4-colour mode) and an interpolated alpha block per 4x4 texels, endpoints
+// from the block's bounding box; quick rather than optimal, this only runs in the asset tool
+// ---------------------------------------------------------------------------------------------------------
+inline uint16_t packRGB565(const unsigned char* c)
+{
+    return (uint16_t)(((c[0] * 31 + 127) / 255) << 11 | ((c[1] * 63 + 127) / 255) << 5 | ((c[2] * 31 + 127) / 255));
+}
+
+inline void unpackRGB565(uint16_t v, int* c)
+{
+    c[0] = ((v >> 11) & 31) * 255 / 31;
+    c[1] = ((v >> 5) & 63) * 255 / 63;
+    c[2] = (v & 31) * 255 / 31;
+}
+
+inline void compressBC3Block(const unsigned char block[16][4], unsigned char* out)
+{
+    // alpha: 8-value mode, a0 > a1
+    unsigned char a0 = 0, a1 = 255;
+    for (int i = 0; i < 16; i++)
+    {
+        a0 = std::max(a0, block[i][3]);
+        a1 = std::min(a1, block[i][3]);
+    }
+    if (a0 == a1)
+    {
+        // one of the endpoints still hits the value exactly
+        if (a0 < 255)
+            a0++;
+        else
+            a1--;
+    }
+    out[0] = a0;
+    out[1] = a1;
+    uint64_t alphaBits = 0;
+    for (int i = 0; i < 16; i++)
+    {
+        // palette position 0..7 from a0 to a1, stored as the BC3 index order 0, 2, 3, 4, 5, 6, 7, 1
+        int step = (int)((a0 - block[i][3]) * 7.0f / (a0 - a1) + 0.5f);
+        static const int order[8] = { 0, 2, 3, 4, 5, 6, 7, 1 };
+        alphaBits |= (uint64_t)order[std::min(std::max(step, 0), 7)] << (3 * i);
+    }
+    for (int i = 0; i < 6; i++)
+        out[2 + i] = (unsigned char)(alphaBits >> (8 * i));
+
+    // colour: bounding box inset by 1/16, c0 > c1 keeps the 4-colour mode
+    unsigned char lo[3] = { 255, 255, 255 }, hi[3] = { 0, 0, 0 };
+    for (int i = 0; i < 16; i++)
+        for (int c = 0; c < 3; c++)
+        {
+            lo[c] = std::min(lo[c], block[i][c]);
+            hi[c] = std::max(hi[c], block[i][c]);
+        }
+    for (int c = 0; c < 3; c++)
+    {
+        int inset = (hi[c] - lo[c]) / 16;
+        lo[c] += inset;
+        hi[c] -= inset;
+    }
+    uint16_t c0 = packRGB565(hi), c1 = packRGB565(lo);
+    if (c0 < c1)
+        std::swap(c0, c1);
+    int palette[4][3];
+    unpackRGB565(c0, palette[0]);
+    unpackRGB565(c1, palette[1]);
+    for (int c = 0; c < 3; c++)
+    {
+        palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+        palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+    uint32_t colorBits = 0;
+    for (int i = 0; i < 16; i++)
+    {
+        int best = 0, bestDistance = 1 << 30;
+        for (int p = 0; p < 4; p++)
+        {
+            int distance = 0;
+            for (int c = 0; c < 3; c++)
+                distance += (block[i][c] - palette[p][c]) * (block[i][c] - palette[p][c]);
+            if (distance < bestDistance)
+            {
+                bestDistance = distance;
+                best = p;
+            }
+        }
+        colorBits |= (uint32_t)best << (2 * i);
+    }
+    out[8] = c0 & 0xff;
+    out[9] = c0 >> 8;
+    out[10] = c1 & 0xff;
+    out[11] = c1 >> 8;
+    for (int i = 0; i < 4; i++)
+        out[12 + i] = (unsigned char)(colorBits >> (8 * i));
+}
+
+inline MipLevel compressBC3(const MipLevel &rgba)
+{
+    MipLevel level;
+    level.width = rgba.width;
+    level.height = rgba.height;
+    level.data.resize(mipLevelSize(MIP_BC3, rgba.width, rgba.height));
+    unsigned char* out = level.data.data();
+    for (int by = 0; by < rgba.height; by += 4)
+        for (int bx = 0; bx < rgba.width; bx += 4)
+        {
+            // texels past the edge repeat the last row/column
+            unsigned char block[16][4];
+            for (int i = 0; i < 16; i++)
+            {
+                int x = std::min(bx + i % 4, rgba.width - 1);
+                int y = std::min(by + i / 4, rgba.height - 1);
+                std::memcpy(block[i], &rgba.data[((size_t)y * rgba.width + x) * 4], 4);
+            }
+            compressBC3Block(block, out);
+            out += 16;
+        }
+    return level;
+}
+
+// ---------------------------------------------------------------------------------------------------------
+struct MipFileHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t levelCount;
+};
+
+inline bool writeMipFile(const std::string &path, MipFormat format, const std::vector<MipLevel> &levels)
+{
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file == nullptr)
+        return false;
+    MipFileHeader header;
+    std::memcpy(header.magic, "MIPS", 4);
+    header.version = MIP_FILE_VERSION;
+    header.format = format;
+    header.width = levels[0].width;
+    header.height = levels[0].height;
+    header.levelCount = levels.size();
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (size_t i = levels.size(); ok && i-- > 0;)
+    {
+        uint32_t size = levels[i].data.size();
+        ok = fwrite(&size, sizeof(size), 1, file) == 1;
+    }
+    for (size_t i = levels.size(); ok && i-- > 0;)
+        ok = fwrite(levels[i].data.data(), 1, levels[i].data.size(), file) == levels[i].data.size();
+    ok = fclose(file) == 0 && ok;
+    if (!ok)
+        remove(path.c_str());
+    return ok;
+}
+
+// false if the file is missing, older than `source`, of another format or broken; both are looked up
+// through FileSystem, so a packed .mips file is read straight out of the archive
+inline bool readMipFile(const std::string &path, const std::string &source, MipFormat format, std::vector<MipLevel> &levels)
+{
+    time_t fileTime = FileSystem::modifiedTime(path);
+    if (fileTime == 0 || FileSystem::modifiedTime(source) > fileTime)
+        return false;
+
+    Asset file = FileSystem::open(path);
+    if (!file.valid() || file.size() < sizeof(MipFileHeader))
+        return false;
+    MipFileHeader header;
+    std::memcpy(&header, file.data(), sizeof(header));
+    size_t offset = sizeof(header);
+    bool ok = std::memcmp(header.magic, "MIPS", 4) == 0 && header.version == MIP_FILE_VERSION &&
+              header.format == (uint32_t)format && header.width > 0 && header.height > 0 &&
+              header.levelCount == (uint32_t)mipLevelCount(header.width, header.height) &&
+              offset + header.levelCount * sizeof(uint32_t) <= file.size();
+    std::vector<uint32_t> sizes(ok ? header.levelCount : 0);
+    if (ok)
+        std::memcpy(sizes.data(), file.data() + offset, sizes.size() * sizeof(uint32_t));
+    offset += sizes.size() * sizeof(uint32_t);
+
+    levels.assign(sizes.size(), MipLevel());
+    for (size_t i = levels.size(); ok && i-- > 0;)
+    {
+        MipLevel &level = levels[i];
+        level.width = std::max(1u, header.width >> i);
+        level.height = std::max(1u, header.height >> i);
+        size_t size = sizes[levels.size() - 1 - i];
+        ok = size == mipLevelSize(format, level.width, level.height) && offset + size <= file.size();
+        if (ok)
+            level.data.assign(file.data() + offset, file.data() + offset + size);
+        offset += size;
+    }
+    if (!ok)
+        levels.clear();
+    return ok;
+}
+
+#endif
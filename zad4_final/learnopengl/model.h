@@ -1,16 +1,19 @@
 #ifndef MODEL_H
 #define MODEL_H
 
-#include <glad/glad.h> 
+#include <GL/glew.h>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
-#include <stb_image.h>
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
 #include <learnopengl/mesh.h>
+#include <learnopengl/mesh_buffer.h>
+#include <learnopengl/materials.h>
+#include <learnopengl/model_cache.h>
+#include <learnopengl/asset_io.h>
 #include <learnopengl/shader.h>
 
 #include <string>
@@ -19,6 +22,10 @@
 #include <iostream>
 #include <map>
 #include <vector>
+#include <memory>
+#include <limits>
+#include <unordered_map>
+#include <chrono>
 using namespace std;
 
 unsigned int TextureFromFile(const char *path, const string &directory, bool gamma = false);
@@ -26,31 +33,178 @@ unsigned int TextureFromFile(const char *path, const string &directory, bool gam
 class Model 
 {
 public:
-    // model data 
+    // model data; meshes stays empty when the model came from its binary cache (see model_cache.h)
     vector<Texture> textures_loaded;	// stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
     vector<Mesh>    meshes;
     string directory;
     bool gammaCorrection;
+    // ACMR and vertex counts of all meshes, before and after mesh optimization; empty, like meshes,
+    // when the model came from its cache, the cached meshes are already optimized
+    MeshOptimizationReport optimization;
+    // bounds of all meshes
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+    // every triangle of every mesh, 3 positions each in model space, as quantized for drawing; the
+    // collision mesh of the model (see InstanceBVH), moved out of the model when it's made an obstacle
+    vector<glm::vec3> collisionTriangles;
+    // whether the meshes came from "<path>.cache" instead of Assimp, and how long loading took
+    bool fromCache;
+    double loadSeconds;
 
-    // constructor, expects a filepath to a 3D model.
-    Model(string const &path, bool gamma = false) : gammaCorrection(gamma)
+    // constructor, expects a filepath to a 3D model. All meshes go into one MeshBuffer and all
+    // textures into one MaterialLibrary: the model's own, or `sharedBuffer`/`sharedMaterials` to put
+    // several models in the same ones; shared ones are uploaded by their owner once every model has
+    // been loaded. The shader needs MaterialLibrary::bindSamplers() once before the first Draw.
+    // Without uploadNow the constructor makes no GL calls (so it can run on any thread, see
+    // ModelLoader) and the model's own buffers are uploaded later by uploadStep() on the GL thread.
+    Model(string const &path, bool gamma = false, MeshBuffer* sharedBuffer = nullptr, MaterialLibrary* sharedMaterials = nullptr,
+          bool uploadNow = true)
+        : gammaCorrection(gamma), rangeCount(0)
     {
-        loadModel(path);
+        if (sharedBuffer == nullptr)
+        {
+            ownBuffer.reset(new MeshBuffer());
+            sharedBuffer = ownBuffer.get();
+        }
+        meshBuffer = sharedBuffer;
+        if (sharedMaterials == nullptr)
+        {
+            ownMaterials.reset(new MaterialLibrary());
+            sharedMaterials = ownMaterials.get();
+        }
+        materials = sharedMaterials;
+        directory = path.substr(0, path.find_last_of('/'));
+
+        // a warm start maps the cache and goes straight to the buffers, a cold one imports and writes the cache
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        boundsMin = glm::vec3(FLT_MAX);
+        boundsMax = glm::vec3(-FLT_MAX);
+        firstRange = meshBuffer->ranges.size();
+        uint64_t sourceHash = hashModelSource(path);
+        ModelCacheFile cache;
+        fromCache = cache.open(path + ".cache", sourceHash);
+        if (fromCache)
+        {
+            for(unsigned int i = 0; i < cache.meshes.size(); i++)
+                addMesh(cache.meshes[i]);
+        }
+        else
+        {
+            loadModel(path);
+
+            vector<CachedMesh> cached(meshes.size());
+            vector<vector<PackedVertex> > packed(meshes.size());
+            for(unsigned int i = 0; i < meshes.size(); i++)
+            {
+                packed[i] = meshes[i].packVertices();
+                cached[i].vertices = packed[i].data();
+                cached[i].vertexCount = packed[i].size();
+                cached[i].indices = meshes[i].indices.data();
+                cached[i].indexCount = meshes[i].indices.size();
+                cached[i].boundsMin = meshes[i].boundsMin;
+                cached[i].boundsExtent = meshes[i].boundsExtent;
+                materialFiles(meshes[i].textures, cached[i].textures);
+                meshes[i].material = addMesh(cached[i]);
+            }
+            if (!meshes.empty() && !ModelCacheFile::write(path + ".cache", sourceHash, cached))
+                cout << path << ": could not write the model cache" << endl;
+        }
+        if (boundsMin.x > boundsMax.x)
+            boundsMin = boundsMax = glm::vec3(0.0f);
+        loadSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << path << ": " << (fromCache ? "warm start from the model cache" : "cold start through Assimp") << ", "
+             << rangeCount << " meshes in " << loadSeconds * 1000.0 << "ms" << endl;
+
+        if (uploadNow)
+            uploadStep(std::numeric_limits<double>::infinity());
     }
 
-    // draws the model, and thus all its meshes
-    void Draw(Shader &shader)
+    // upload the model's own buffers and textures until glfwGetTime() passes the deadline, at least
+    // one mip level per call; returns true once the model can be drawn, its textures keep sharpening
+    // with later calls until uploadComplete(). GL thread only.
+    bool uploadStep(double deadline)
     {
-        for(unsigned int i = 0; i < meshes.size(); i++)
-            meshes[i].Draw(shader);
+        if (ownBuffer && !meshBuffer->uploaded())
+            meshBuffer->upload();
+        return !ownMaterials || materials->uploadStep(deadline);
+    }
+
+    bool uploadComplete() const
+    {
+        return (!ownBuffer || meshBuffer->uploaded()) && (!ownMaterials || materials->complete());
+    }
+
+    // draws the model, and thus all its meshes: every mesh selects its own material, so it's one multi-draw
+    void Draw()
+    {
+        materials->bind();
+        meshBuffer->bind();
+        meshBuffer->draw(firstRange, rangeCount);
+        glBindVertexArray(0);
+    }
+
+    MaterialLibrary &materialLibrary()
+    {
+        return *materials;
     }
     
 private:
+    // textures_loaded index by path, so a texture is looked up in constant time
+    unordered_map<string, unsigned int> textureIndex;
+    MeshBuffer* meshBuffer;
+    unique_ptr<MeshBuffer> ownBuffer;
+    MaterialLibrary* materials;
+    unique_ptr<MaterialLibrary> ownMaterials;
+    // index of the first mesh's range in meshBuffer, the model's ranges are consecutive
+    size_t firstRange;
+    size_t rangeCount;
+
+    // a mesh into the buffers and its textures into the material library; returns the material
+    unsigned int addMesh(const CachedMesh &mesh)
+    {
+        int handles[4];
+        for(int k = 0; k < 4; k++)
+            handles[k] = mesh.textures[k].empty() ? -1 : materials->addTexture(this->directory + '/' + mesh.textures[k]);
+        unsigned int material = materials->addMaterial(handles[0], handles[1], handles[2], handles[3]);
+        meshBuffer->add(mesh.vertices, mesh.vertexCount, mesh.indices, mesh.indexCount, mesh.boundsMin, mesh.boundsExtent, material);
+        rangeCount++;
+
+        for(uint32_t i = 0; i + 2 < mesh.indexCount; i += 3)
+            for(int k = 0; k < 3; k++)
+            {
+                uint32_t index = std::min(mesh.indices[i + k], mesh.vertexCount - 1);
+                const uint16_t* position = mesh.vertices[index].position;
+                collisionTriangles.push_back(mesh.boundsMin + mesh.boundsExtent *
+                                             glm::vec3(position[0], position[1], position[2]) / 65535.0f);
+            }
+
+        if (mesh.vertexCount > 0)
+        {
+            boundsMin = glm::min(boundsMin, mesh.boundsMin);
+            boundsMax = glm::max(boundsMax, mesh.boundsMin + mesh.boundsExtent);
+        }
+        return material;
+    }
+
+    // the first diffuse, specular, normal and height texture make a mesh's material
+    static void materialFiles(const vector<Texture> &textures, string files[4])
+    {
+        const char* types[4] = { "texture_diffuse", "texture_specular", "texture_normal", "texture_height" };
+        for(int k = 0; k < 4; k++)
+        {
+            files[k].clear();
+            for(unsigned int i = 0; i < textures.size() && files[k].empty(); i++)
+                if (textures[i].type == types[k])
+                    files[k] = textures[i].path;
+        }
+    }
+
     // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
     void loadModel(string const &path)
     {
-        // read file via ASSIMP
+        // read file via ASSIMP, through FileSystem
         Assimp::Importer importer;
+        importer.SetIOHandler(new AssetIOSystem());
         const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
         // check for errors
         if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
@@ -63,6 +217,16 @@ private:
 
         // process ASSIMP's root node recursively
         processNode(scene->mRootNode, scene);
+
+        for(unsigned int i = 0; i < meshes.size(); i++)
+            optimization.merge(meshes[i].optimization);
+        optimization.print(path);
+
+        size_t vertexCount = 0;
+        for(unsigned int i = 0; i < meshes.size(); i++)
+            vertexCount += meshes[i].vertices.size();
+        cout << path << ": vertex memory " << vertexCount * sizeof(PackedVertex) / 1024 << "KB packed, "
+             << vertexCount * sizeof(Vertex) / 1024 << "KB as floats" << endl;
     }
 
     // processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
@@ -130,7 +294,11 @@ private:
                 vertex.Bitangent = vector;
             }
             else
+            {
                 vertex.TexCoords = glm::vec2(0.0f, 0.0f);
+                vertex.Tangent = glm::vec3(0.0f);
+                vertex.Bitangent = glm::vec3(0.0f);
+            }
 
             vertices.push_back(vertex);
         }
@@ -164,11 +332,13 @@ private:
         std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
         textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
         
-        // return a mesh object created from the extracted mesh data
-        return Mesh(vertices, indices, textures);
+        // return a mesh object created from the extracted mesh data, its buffers and material are
+        // the model's, see addMesh
+        return Mesh(vertices, indices, textures, false);
     }
 
-    // checks all material textures of a given type and loads the textures if they're not loaded yet.
+    // checks all material textures of a given type and records the ones not seen yet; the images
+    // themselves are decoded by the MaterialLibrary (ids stay 0), see processMesh.
     // the required info is returned as a Texture struct.
     vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, string typeName)
     {
@@ -178,23 +348,19 @@ private:
             aiString str;
             mat->GetTexture(type, i, &str);
             // check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-            bool skip = false;
-            for(unsigned int j = 0; j < textures_loaded.size(); j++)
+            unordered_map<string, unsigned int>::iterator loaded = textureIndex.find(str.C_Str());
+            if(loaded != textureIndex.end())
             {
-                if(std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-                {
-                    textures.push_back(textures_loaded[j]);
-                    skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
-                    break;
-                }
+                textures.push_back(textures_loaded[loaded->second]); // a texture with the same filepath has already been loaded (optimization)
             }
-            if(!skip)
-            {   // if texture hasn't been loaded already, load it
+            else
+            {   // if texture hasn't been loaded already, record it
                 Texture texture;
-                texture.id = TextureFromFile(str.C_Str(), this->directory);
+                texture.id = 0;
                 texture.type = typeName;
                 texture.path = str.C_Str();
                 textures.push_back(texture);
+                textureIndex[texture.path] = textures_loaded.size();
                 textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
             }
         }
@@ -203,6 +369,8 @@ private:
 };
 
 
+// a GL_TEXTURE_2D with the image's precomputed mip chain (see TextureCache), BC3 where there is one
+// and the driver takes S3TC
 unsigned int TextureFromFile(const char *path, const string &directory, bool gamma)
 {
     string filename = string(path);
@@ -211,33 +379,27 @@ unsigned int TextureFromFile(const char *path, const string &directory, bool gam
     unsigned int textureID;
     glGenTextures(1, &textureID);
 
-    int width, height, nrComponents;
-    unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-    if (data)
+    shared_ptr<const CachedImage> image = TextureCache::instance().acquire(FileSystem::canonicalPath(filename), !GLEW_EXT_texture_compression_s3tc);
+    if (image)
     {
-        GLenum format;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
-
         glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
+        bool compressed = GLEW_EXT_texture_compression_s3tc && !image->compressed.empty();
+        const vector<MipLevel> &levels = compressed ? image->compressed : image->levels;
+        for (unsigned int level = 0; level < levels.size(); level++)
+        {
+            if (compressed)
+                glCompressedTexImage2D(GL_TEXTURE_2D, level, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, levels[level].width, levels[level].height, 0,
+                                       levels[level].data.size(), levels[level].data.data());
+            else
+                glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, levels[level].width, levels[level].height, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                             levels[level].data.data());
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels.size() - 1);
 
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
-    }
-    else
-    {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
     }
 
     return textureID;
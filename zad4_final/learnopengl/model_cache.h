@@ -0,0 +1,211 @@
+#ifndef MODEL_CACHE_H
+#define MODEL_CACHE_H
+
+#include <glm/glm.hpp>
+
+#include <learnopengl/packed_vertex.h>
+#include <learnopengl/filesystem.h>
+
+#include <string>
+#include <atomic>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <unistd.h>
+
+// Binary cache of a processed model, written next to the source as "<source>.cache" so later runs
+// skip Assimp, mesh optimization and packing. The file is opened through FileSystem (mapped, or a view
+// into the asset archive when it was packed) and its vertices and indices are used in place:
+//   header       "MDLC", version, hash of the source file, mesh count
+//   per mesh     MeshRecord, the four texture file names (relative to the model's directory, each
+//                padded to 4 bytes), PackedVertex[vertexCount], uint32 indices[indexCount]
+// The hash covers the source file's bytes and MODEL_CACHE_VERSION, so a changed model or a change
+// to the processing invalidates the cache; files the source refers to (.mtl, textures) are not covered.
+
+// bump whenever what Model does to a mesh before it is cached changes
+const uint32_t MODEL_CACHE_VERSION = 1;
+
+// one mesh: pointers into the mapped file when read, into the caller's data when written
+struct CachedMesh
+{
+    const PackedVertex* vertices;
+    uint32_t vertexCount;
+    const uint32_t* indices;
+    uint32_t indexCount;
+    glm::vec3 boundsMin;
+    glm::vec3 boundsExtent;
+    // diffuse, specular, normal, height; empty if the mesh has none
+    std::string textures[4];
+};
+
+// FNV-1a of the source file and the cache version, 0 if the file can't be read
+// ---------------------------------------------------------------------------------------------------------
+inline uint64_t hashModelSource(const std::string &path)
+{
+    Asset source = FileSystem::open(path);
+    if (!source.valid())
+        return 0;
+
+    uint64_t hash = 14695981039346656037ull;
+    const unsigned char* version = (const unsigned char*)&MODEL_CACHE_VERSION;
+    for (size_t i = 0; i < sizeof(MODEL_CACHE_VERSION); i++)
+        hash = (hash ^ version[i]) * 1099511628211ull;
+    const unsigned char* bytes = (const unsigned char*)source.data();
+    for (size_t i = 0; i < source.size(); i++)
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    return hash == 0 ? 1 : hash;
+}
+
+// An opened cache file; meshes point into it and stay valid while the object lives.
+class ModelCacheFile
+{
+public:
+    std::vector<CachedMesh> meshes;
+
+    ModelCacheFile()
+    {
+    }
+
+    // open the file and check it belongs to a source with this hash; false if missing, stale or broken
+    // ------------------------------------------------------------------------
+    bool open(const std::string &cachePath, uint64_t sourceHash)
+    {
+        if (sourceHash == 0)
+            return false;
+        file = FileSystem::open(cachePath);
+        size_t size = file.size();
+        if (!file.valid() || size < sizeof(Header))
+            return false;
+
+        const char* bytes = file.data();
+        const Header* header = (const Header*)bytes;
+        if (std::memcmp(header->magic, "MDLC", 4) != 0 || header->version != MODEL_CACHE_VERSION ||
+            header->sourceHash != sourceHash)
+            return false;
+
+        // every size is checked against the file, a truncated cache is just a miss
+        size_t offset = sizeof(Header);
+        for (uint32_t m = 0; m < header->meshCount; m++)
+        {
+            if (offset + sizeof(MeshRecord) > size)
+                return fail();
+            const MeshRecord* record = (const MeshRecord*)(bytes + offset);
+            offset += sizeof(MeshRecord);
+
+            CachedMesh mesh;
+            for (int k = 0; k < 4; k++)
+            {
+                if (offset + record->textureLength[k] > size)
+                    return fail();
+                mesh.textures[k].assign(bytes + offset, record->textureLength[k]);
+                offset += padded(record->textureLength[k]);
+            }
+            if (offset + (size_t)record->vertexCount * sizeof(PackedVertex) + (size_t)record->indexCount * sizeof(uint32_t) > size)
+                return fail();
+            mesh.vertexCount = record->vertexCount;
+            mesh.vertices = (const PackedVertex*)(bytes + offset);
+            offset += padded((size_t)record->vertexCount * sizeof(PackedVertex));
+            mesh.indexCount = record->indexCount;
+            mesh.indices = (const uint32_t*)(bytes + offset);
+            offset += (size_t)record->indexCount * sizeof(uint32_t);
+            mesh.boundsMin = glm::vec3(record->boundsMin[0], record->boundsMin[1], record->boundsMin[2]);
+            mesh.boundsExtent = glm::vec3(record->boundsExtent[0], record->boundsExtent[1], record->boundsExtent[2]);
+            meshes.push_back(mesh);
+        }
+        return true;
+    }
+
+    // write through a temporary file and rename it, so a reader never sees half a cache; the temporary
+    // name is unique per call, loader threads writing the same model each get their own
+    // ------------------------------------------------------------------------
+    static bool write(const std::string &cachePath, uint64_t sourceHash, const std::vector<CachedMesh> &meshes)
+    {
+        static std::atomic<unsigned long> writes(0);
+        if (sourceHash == 0)
+            return false;
+        std::string temporary = cachePath + ".tmp" + std::to_string((unsigned long)getpid()) + "." +
+                                std::to_string(writes++);
+        FILE* file = fopen(temporary.c_str(), "wb");
+        if (file == nullptr)
+            return false;
+
+        Header header;
+        std::memcpy(header.magic, "MDLC", 4);
+        header.version = MODEL_CACHE_VERSION;
+        header.sourceHash = sourceHash;
+        header.meshCount = meshes.size();
+        header.reserved = 0;
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+
+        const char zeros[4] = { 0, 0, 0, 0 };
+        for (size_t m = 0; ok && m < meshes.size(); m++)
+        {
+            const CachedMesh &mesh = meshes[m];
+            MeshRecord record;
+            record.vertexCount = mesh.vertexCount;
+            record.indexCount = mesh.indexCount;
+            for (int k = 0; k < 3; k++)
+            {
+                record.boundsMin[k] = mesh.boundsMin[k];
+                record.boundsExtent[k] = mesh.boundsExtent[k];
+            }
+            for (int k = 0; k < 4; k++)
+                record.textureLength[k] = mesh.textures[k].size();
+            ok = fwrite(&record, sizeof(record), 1, file) == 1;
+            for (int k = 0; ok && k < 4; k++)
+                ok = fwrite(mesh.textures[k].data(), 1, mesh.textures[k].size(), file) == mesh.textures[k].size() &&
+                     fwrite(zeros, 1, padded(mesh.textures[k].size()) - mesh.textures[k].size(), file) ==
+                         padded(mesh.textures[k].size()) - mesh.textures[k].size();
+            size_t vertexBytes = (size_t)mesh.vertexCount * sizeof(PackedVertex);
+            ok = ok && fwrite(mesh.vertices, 1, vertexBytes, file) == vertexBytes &&
+                 fwrite(zeros, 1, padded(vertexBytes) - vertexBytes, file) == padded(vertexBytes) - vertexBytes &&
+                 fwrite(mesh.indices, sizeof(uint32_t), mesh.indexCount, file) == mesh.indexCount;
+        }
+
+        ok = fclose(file) == 0 && ok;
+        if (ok)
+            ok = rename(temporary.c_str(), cachePath.c_str()) == 0;
+        if (!ok)
+            remove(temporary.c_str());
+        return ok;
+    }
+
+private:
+    struct Header
+    {
+        char magic[4];
+        uint32_t version;
+        uint64_t sourceHash;
+        uint32_t meshCount;
+        uint32_t reserved;
+    };
+
+    struct MeshRecord
+    {
+        uint32_t vertexCount;
+        uint32_t indexCount;
+        float boundsMin[3];
+        float boundsExtent[3];
+        uint32_t textureLength[4];
+    };
+
+    Asset file;
+
+    bool fail()
+    {
+        meshes.clear();
+        return false;
+    }
+
+    static size_t padded(size_t bytes)
+    {
+        return (bytes + 3) & ~(size_t)3;
+    }
+
+    // meshes point into file
+    ModelCacheFile(const ModelCacheFile&);
+    ModelCacheFile& operator=(const ModelCacheFile&);
+};
+
+#endif
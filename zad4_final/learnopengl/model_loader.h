@@ -0,0 +1,174 @@
+#ifndef MODEL_LOADER_H
+#define MODEL_LOADER_H
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include <learnopengl/model.h>
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+
+// Loads Models without stalling the render loop. Worker threads do everything that needs no GL:
+// the Assimp import, mesh optimization and packing, and decoding the textures. update(), called
+// once a frame on the GL thread, then uploads the loaded models within a time budget, the textures
+// one mip level at a time through a pixel buffer object (MaterialLibrary::uploadStep). A model can be
+// drawn as soon as the coarsest levels of its textures are in; the finer ones follow in later
+// frames, after every newly loaded model got its turn, so the models show up quickly one after
+// another while the frame keeps going.
+class ModelLoader
+{
+public:
+    // threadCount 0: one thread less than the hardware has, at least one; the threads start with the
+    // first load()
+    ModelLoader(unsigned int threadCount = 0) : threadCount(threadCount), stopping(false), readyCount(0)
+    {
+        if (this->threadCount == 0)
+        {
+            // hardware_concurrency() may not know and return 0
+            unsigned int hardware = std::thread::hardware_concurrency();
+            this->threadCount = hardware > 1 ? hardware - 1 : 1;
+        }
+    }
+
+    ~ModelLoader()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread &worker : workers)
+            worker.join();
+    }
+
+    // queue a model, returns the handle for get()
+    // ------------------------------------------------------------------------
+    size_t load(const std::string &path)
+    {
+        if (workers.empty())
+            for (unsigned int i = 0; i < threadCount; i++)
+                workers.push_back(std::thread([this]() { work(); }));
+
+        std::unique_ptr<Entry> entry(new Entry());
+        entry->path = path;
+        entry->state = QUEUED;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queued.push_back(entry.get());
+        }
+        entries.push_back(std::move(entry));
+        wake.notify_one();
+        return entries.size() - 1;
+    }
+
+    // upload loaded models until `budget` seconds have passed; GL thread only
+    // ------------------------------------------------------------------------
+    void update(double budget)
+    {
+        double deadline = glfwGetTime() + budget;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            uploading.insert(uploading.end(), loaded.begin(), loaded.end());
+            loaded.clear();
+        }
+        while (!uploading.empty())
+        {
+            Entry* entry = uploading.front();
+            if (!entry->model->uploadStep(deadline))
+                return;
+            entry->state = READY;
+            readyCount++;
+            uploading.pop_front();
+            if (!entry->model->uploadComplete())
+                refining.push_back(entry);
+            if (glfwGetTime() >= deadline)
+                return;
+        }
+        while (!refining.empty())
+        {
+            Entry* entry = refining.front();
+            entry->model->uploadStep(deadline);
+            if (entry->model->uploadComplete())
+                refining.pop_front();
+            if (glfwGetTime() >= deadline)
+                return;
+        }
+    }
+
+    // the model once it can be drawn, nullptr until then
+    // ------------------------------------------------------------------------
+    Model* get(size_t handle) const
+    {
+        return entries[handle]->state == READY ? entries[handle]->model.get() : nullptr;
+    }
+
+    size_t size() const
+    {
+        return entries.size();
+    }
+
+    // every model queued so far is completely uploaded
+    bool done() const
+    {
+        return readyCount == entries.size() && refining.empty();
+    }
+
+private:
+    enum State { QUEUED, LOADED, READY };
+
+    struct Entry
+    {
+        std::string path;
+        std::unique_ptr<Model> model;
+        std::atomic<int> state;
+    };
+
+    // entries is only touched by the GL thread; the workers see entries through the queues
+    std::vector<std::unique_ptr<Entry> > entries;
+    std::deque<Entry*> queued;
+    std::deque<Entry*> loaded;
+    std::deque<Entry*> uploading;
+    std::deque<Entry*> refining;
+    unsigned int threadCount;
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping;
+    size_t readyCount;
+
+    void work()
+    {
+        for (;;)
+        {
+            Entry* entry;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this]() { return stopping || !queued.empty(); });
+                if (stopping)
+                    return;
+                entry = queued.front();
+                queued.pop_front();
+            }
+
+            // the model's own buffers, no GL calls until uploadStep()
+            entry->model.reset(new Model(entry->path, false, nullptr, nullptr, false));
+
+            std::lock_guard<std::mutex> lock(mutex);
+            entry->state = LOADED;
+            loaded.push_back(entry);
+        }
+    }
+
+    ModelLoader(const ModelLoader&);
+    ModelLoader& operator=(const ModelLoader&);
+};
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef PACKED_VERTEX_H
+#define PACKED_VERTEX_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+
+// GPU vertex layout of Mesh, 20 bytes instead of the 56 of Vertex:
+//  position  4 x unorm16, xyz relative to the mesh bounds, w the bitangent sign (0 = -1, 1 = +1)
+//  normal    2 x snorm16, octahedral
+//  uv        2 x half float
+//  tangent   2 x snorm16, octahedral; the bitangent is cross(normal, tangent) * sign
+// the bounds go to attributes 4 (min) and 5 (extent), the material index to 6; decoded by packed_vertex.glsl
+struct PackedVertex
+{
+    uint16_t position[4];
+    int16_t normal[2];
+    uint16_t texCoords[2];
+    int16_t tangent[2];
+};
+
+// value >> shift (1 <= shift < 32) rounded to nearest, ties to even
+// ---------------------------------------------------------------------------------------------------------
+inline uint32_t shiftRoundEven(uint32_t value, int shift)
+{
+    uint32_t kept = value >> shift;
+    uint32_t rest = value & ((1u << shift) - 1u);
+    uint32_t half = 1u << (shift - 1);
+    return kept + ((rest > half || (rest == half && (kept & 1u))) ? 1u : 0u);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+inline uint16_t floatToHalf(float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    uint32_t sign = (bits >> 16) & 0x8000u;
+    int exponent = (int)((bits >> 23) & 0xffu) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffffu;
+
+    if (((bits >> 23) & 0xffu) == 0xffu)
+        return (uint16_t)(sign | 0x7c00u | (mantissa ? 0x200u : 0u));   // inf, nan
+    if (exponent >= 31)
+        return (uint16_t)(sign | 0x7c00u);                               // too large: inf
+    if (exponent <= 0)
+    {
+        if (exponent < -10)
+            return (uint16_t)sign;                                       // too small: zero
+        return (uint16_t)(sign | shiftRoundEven(mantissa | 0x800000u, 14 - exponent));   // denormal
+    }
+    // rounded to nearest even like the GPU's own conversion; a carry into the exponent is still correct
+    return (uint16_t)((sign | ((uint32_t)exponent << 10)) + shiftRoundEven(mantissa, 13));
+}
+
+inline int16_t floatToSnorm16(float value)
+{
+    return (int16_t)std::lround(glm::clamp(value, -1.0f, 1.0f) * 32767.0f);
+}
+
+inline uint16_t floatToUnorm16(float value)
+{
+    return (uint16_t)std::lround(glm::clamp(value, 0.0f, 1.0f) * 65535.0f);
+}
+
+// unit vector -> point of the octahedron unfolded onto [-1, 1]^2
+// ---------------------------------------------------------------------------------------------------------
+inline glm::vec2 octahedralEncode(glm::vec3 n)
+{
+    n = n * (1.0f / (std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z)));
+    glm::vec2 e(n.x, n.y);
+    if (n.z < 0.0f)
+    {
+        e.x = (1.0f - std::fabs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+        e.y = (1.0f - std::fabs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+    }
+    return e;
+}
+
+inline bool usableDirection(glm::vec3 v)
+{
+    return std::isfinite(v.x) && std::isfinite(v.y) && std::isfinite(v.z) && glm::dot(v, v) > 1e-20f;
+}
+
+// boundsMin/boundsExtent: the mesh bounds the positions are quantized to
+// ---------------------------------------------------------------------------------------------------------
+inline PackedVertex packVertex(glm::vec3 position, glm::vec3 normal, glm::vec2 texCoords, glm::vec3 tangent,
+                               glm::vec3 bitangent, glm::vec3 boundsMin, glm::vec3 boundsExtent)
+{
+    PackedVertex packed;
+    for (int i = 0; i < 3; i++)
+        packed.position[i] = boundsExtent[i] > 0.0f ? floatToUnorm16((position[i] - boundsMin[i]) / boundsExtent[i]) : 0;
+
+    if (!usableDirection(normal))
+        normal = glm::vec3(0.0f, 0.0f, 1.0f);
+    normal = glm::normalize(normal);
+
+    // meshes without texture coordinates have no tangents, any direction perpendicular to the normal will do
+    tangent = tangent - normal * glm::dot(normal, tangent);
+    if (!usableDirection(tangent))
+        tangent = glm::cross(normal, std::fabs(normal.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f));
+    tangent = glm::normalize(tangent);
+
+    bool positiveBitangent = !usableDirection(bitangent) || glm::dot(glm::cross(normal, tangent), bitangent) >= 0.0f;
+    packed.position[3] = positiveBitangent ? 65535 : 0;
+
+    glm::vec2 n = octahedralEncode(normal);
+    glm::vec2 t = octahedralEncode(tangent);
+    packed.normal[0] = floatToSnorm16(n.x);
+    packed.normal[1] = floatToSnorm16(n.y);
+    packed.tangent[0] = floatToSnorm16(t.x);
+    packed.tangent[1] = floatToSnorm16(t.y);
+    packed.texCoords[0] = floatToHalf(texCoords.x);
+    packed.texCoords[1] = floatToHalf(texCoords.y);
+    return packed;
+}
+
+// attribute pointers for the bound VAO and GL_ARRAY_BUFFER, starting at byte offset `base`
+// ---------------------------------------------------------------------------------------------------------
+inline void setupPackedVertexAttributes(size_t base = 0)
+{
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 4, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)(base + offsetof(PackedVertex, position)));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)(base + offsetof(PackedVertex, normal)));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex), (void*)(base + offsetof(PackedVertex, texCoords)));
+    glEnableVertexAttribArray(3);
+    glVertexAttribPointer(3, 2, GL_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)(base + offsetof(PackedVertex, tangent)));
+}
+
+#endif
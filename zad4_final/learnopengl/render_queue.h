@@ -0,0 +1,384 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+#include <learnopengl/gl_owner.h>
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+// Remembers which program, VAO, buffers, buffer textures and fixed-function state are current and skips the
+// GL call when a request would not change anything. Counts issued and skipped calls.
+class GLStateCache
+{
+public:
+    static const unsigned int MAX_UNIFORM_BINDINGS = 8;
+    static const unsigned int MAX_BUFFER_TEXTURES = 2;
+
+    unsigned int issuedCalls;
+    unsigned int skippedCalls;
+
+    GLStateCache() : issuedCalls(0), skippedCalls(0)
+    {
+        invalidate();
+    }
+
+    // forget everything, call this when code outside the cache may have changed GL state
+    // ------------------------------------------------------------------------
+    void invalidate()
+    {
+        program = ~0u;
+        vertexArray = ~0u;
+        arrayBuffer = ~0u;
+        for (unsigned int i = 0; i < MAX_UNIFORM_BINDINGS; i++)
+        {
+            uniformBuffers[i] = ~0u;
+            uniformOffsets[i] = -1;
+            uniformSizes[i] = -1;
+        }
+        activeTexture = ~0u;
+        for (unsigned int i = 0; i < MAX_BUFFER_TEXTURES; i++)
+            bufferTextures[i] = ~0u;
+        for (int i = 0; i < 4; i++)
+            viewportRect[i] = -1;
+        depthTest = -1;
+    }
+
+    void resetCounters()
+    {
+        issuedCalls = 0;
+        skippedCalls = 0;
+    }
+
+    // ------------------------------------------------------------------------
+    void useProgram(GLuint id)
+    {
+        if (!changed(program, id))
+            return;
+        glUseProgram(id);
+    }
+
+    void bindVertexArray(GLuint id)
+    {
+        if (!changed(vertexArray, id))
+            return;
+        glBindVertexArray(id);
+    }
+
+    // the element array binding is part of the VAO, so only GL_ARRAY_BUFFER is tracked here
+    void bindArrayBuffer(GLuint id)
+    {
+        if (!changed(arrayBuffer, id))
+            return;
+        glBindBuffer(GL_ARRAY_BUFFER, id);
+    }
+
+    void bindUniformBufferRange(GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+    {
+        if (index < MAX_UNIFORM_BINDINGS && uniformBuffers[index] == buffer &&
+            uniformOffsets[index] == offset && uniformSizes[index] == size)
+        {
+            skippedCalls++;
+            return;
+        }
+        if (index < MAX_UNIFORM_BINDINGS)
+        {
+            uniformBuffers[index] = buffer;
+            uniformOffsets[index] = offset;
+            uniformSizes[index] = size;
+        }
+        glBindBufferRange(GL_UNIFORM_BUFFER, index, buffer, offset, size);
+        issuedCalls++;
+    }
+
+    // GL_TEXTURE_BUFFER binding of texture unit `unit`
+    void bindBufferTexture(unsigned int unit, GLuint id)
+    {
+        if (!changed(bufferTextures[unit], id))
+            return;
+        if (activeTexture != unit)
+        {
+            glActiveTexture(GL_TEXTURE0 + unit);
+            activeTexture = unit;
+            issuedCalls++;
+        }
+        glBindTexture(GL_TEXTURE_BUFFER, id);
+    }
+
+    void viewport(int x, int y, int width, int height)
+    {
+        if (viewportRect[0] == x && viewportRect[1] == y && viewportRect[2] == width && viewportRect[3] == height)
+        {
+            skippedCalls++;
+            return;
+        }
+        viewportRect[0] = x;
+        viewportRect[1] = y;
+        viewportRect[2] = width;
+        viewportRect[3] = height;
+        glViewport(x, y, width, height);
+        issuedCalls++;
+    }
+
+    void setDepthTest(bool enabled)
+    {
+        if (depthTest == (int)enabled)
+        {
+            skippedCalls++;
+            return;
+        }
+        depthTest = enabled;
+        if (enabled)
+            glEnable(GL_DEPTH_TEST);
+        else
+            glDisable(GL_DEPTH_TEST);
+        issuedCalls++;
+    }
+
+private:
+    GLuint program;
+    GLuint vertexArray;
+    GLuint arrayBuffer;
+    GLuint uniformBuffers[MAX_UNIFORM_BINDINGS];
+    GLintptr uniformOffsets[MAX_UNIFORM_BINDINGS];
+    GLsizeiptr uniformSizes[MAX_UNIFORM_BINDINGS];
+    GLuint activeTexture;
+    GLuint bufferTextures[MAX_BUFFER_TEXTURES];
+    int viewportRect[4];
+    int depthTest;
+
+    bool changed(GLuint &current, GLuint id)
+    {
+        if (current == id)
+        {
+            skippedCalls++;
+            return false;
+        }
+        current = id;
+        issuedCalls++;
+        return true;
+    }
+};
+
+// A view is a viewport with its own projection/view matrices and depth test setting.
+struct RenderView
+{
+    int viewport[4];
+    bool depthTest;
+    glm::mat4 projection;
+    glm::mat4 view;
+};
+
+// One recorded draw. indexType == 0 means glDrawArrays*, otherwise glDrawElements*.
+// uniformLocation >= 0 sets one vec3 uniform of the program right before the draw.
+// Non-zero bufferTextures are bound to texture units 0 and 1 as GL_TEXTURE_BUFFER.
+struct RenderCommand
+{
+    uint64_t key;
+    unsigned int view;
+    GLuint program;
+    GLuint vertexArray;
+    GLenum mode;
+    GLsizei count;
+    GLenum indexType;
+    GLsizei instanceCount;
+    GLint uniformLocation;
+    glm::vec3 uniformValue;
+    GLuint bufferTextures[GLStateCache::MAX_BUFFER_TEXTURES];
+};
+
+// Draws are recorded during the frame and submitted in flush(), sorted by
+// view -> layer -> program -> VAO, through a GLStateCache so repeated binds cost nothing.
+// Within a view, layers keep their order (e.g. overlays drawn without depth test);
+// within a layer draws may be reordered freely. Every view's matrices go into one
+// uniform buffer at aligned offsets, uploaded once per frame and selected with glBindBufferRange.
+class RenderQueue : private GLOwner
+{
+public:
+    unsigned int commandsLastFrame;
+
+    RenderQueue(unsigned int matricesBinding) : commandsLastFrame(0), binding(matricesBinding), ubo(0), uboViews(0)
+    {
+        GLint alignment = 256;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        viewStride = ((2 * sizeof(glm::mat4) + alignment - 1) / alignment) * alignment;
+    }
+
+    ~RenderQueue()
+    {
+        if (ubo != 0 && glReleasable())
+            glDeleteBuffers(1, &ubo);
+    }
+
+    // returns the view index to record draws with
+    // ------------------------------------------------------------------------
+    unsigned int addView(int x, int y, int width, int height, bool depthTest,
+                         const glm::mat4 &projection, const glm::mat4 &view)
+    {
+        RenderView renderView;
+        renderView.viewport[0] = x;
+        renderView.viewport[1] = y;
+        renderView.viewport[2] = width;
+        renderView.viewport[3] = height;
+        renderView.depthTest = depthTest;
+        renderView.projection = projection;
+        renderView.view = view;
+        views.push_back(renderView);
+        return views.size() - 1;
+    }
+
+    // ------------------------------------------------------------------------
+    void drawArraysInstanced(unsigned int view, unsigned int layer, GLuint program, GLuint vertexArray,
+                             GLenum mode, GLsizei count, GLsizei instanceCount)
+    {
+        record(view, layer, program, vertexArray, mode, count, 0, instanceCount, -1, glm::vec3(0.0f));
+    }
+
+    // non-instanced draw that reads its data from two buffer textures (vertex pulling)
+    void drawArraysPulled(unsigned int view, unsigned int layer, GLuint program, GLuint vertexArray,
+                          GLenum mode, GLsizei count, GLuint bufferTexture0, GLuint bufferTexture1)
+    {
+        record(view, layer, program, vertexArray, mode, count, 0, 1, -1, glm::vec3(0.0f));
+        commands.back().bufferTextures[0] = bufferTexture0;
+        commands.back().bufferTextures[1] = bufferTexture1;
+    }
+
+    void drawElements(unsigned int view, unsigned int layer, GLuint program, GLuint vertexArray,
+                      GLenum mode, GLsizei count, GLenum indexType,
+                      GLint uniformLocation = -1, const glm::vec3 &uniformValue = glm::vec3(0.0f))
+    {
+        record(view, layer, program, vertexArray, mode, count, indexType, 1, uniformLocation, uniformValue);
+    }
+
+    void drawElementsInstanced(unsigned int view, unsigned int layer, GLuint program, GLuint vertexArray,
+                               GLenum mode, GLsizei count, GLenum indexType, GLsizei instanceCount)
+    {
+        record(view, layer, program, vertexArray, mode, count, indexType, instanceCount, -1, glm::vec3(0.0f));
+    }
+
+    // upload the view matrices, sort and submit everything recorded this frame
+    // ------------------------------------------------------------------------
+    void flush(GLStateCache &state)
+    {
+        uploadViews(state);
+
+        std::stable_sort(commands.begin(), commands.end(),
+                         [](const RenderCommand &a, const RenderCommand &b) { return a.key < b.key; });
+
+        unsigned int currentView = ~0u;
+        for (const RenderCommand &command : commands)
+        {
+            if (command.view != currentView)
+            {
+                const RenderView &view = views[command.view];
+                state.viewport(view.viewport[0], view.viewport[1], view.viewport[2], view.viewport[3]);
+                state.setDepthTest(view.depthTest);
+                state.bindUniformBufferRange(binding, ubo, command.view * viewStride, 2 * sizeof(glm::mat4));
+                currentView = command.view;
+            }
+            state.useProgram(command.program);
+            state.bindVertexArray(command.vertexArray);
+            for (unsigned int unit = 0; unit < GLStateCache::MAX_BUFFER_TEXTURES; unit++)
+                if (command.bufferTextures[unit] != 0)
+                    state.bindBufferTexture(unit, command.bufferTextures[unit]);
+            if (command.uniformLocation >= 0)
+                glUniform3fv(command.uniformLocation, 1, &command.uniformValue[0]);
+
+            if (command.indexType == 0)
+            {
+                if (command.instanceCount == 1)
+                    glDrawArrays(command.mode, 0, command.count);
+                else
+                    glDrawArraysInstanced(command.mode, 0, command.count, command.instanceCount);
+            }
+            else
+            {
+                if (command.instanceCount == 1)
+                    glDrawElements(command.mode, command.count, command.indexType, (void*)0);
+                else
+                    glDrawElementsInstanced(command.mode, command.count, command.indexType, (void*)0, command.instanceCount);
+            }
+        }
+
+        commandsLastFrame = commands.size();
+        commands.clear();
+        flushedViews.swap(views);
+        views.clear();
+    }
+
+    // viewport, depth test and matrices of a view of the last flush, for draws the queue can't record
+    // ------------------------------------------------------------------------
+    void bindFlushedView(GLStateCache &state, unsigned int view)
+    {
+        const RenderView &renderView = flushedViews[view];
+        state.viewport(renderView.viewport[0], renderView.viewport[1], renderView.viewport[2], renderView.viewport[3]);
+        state.setDepthTest(renderView.depthTest);
+        state.bindUniformBufferRange(binding, ubo, view * viewStride, 2 * sizeof(glm::mat4));
+    }
+
+private:
+    unsigned int binding;
+    unsigned int ubo;
+    unsigned int uboViews;
+    GLsizeiptr viewStride;
+    std::vector<RenderView> views;
+    std::vector<RenderView> flushedViews;
+    std::vector<RenderCommand> commands;
+    std::vector<char> staging;
+
+    void record(unsigned int view, unsigned int layer, GLuint program, GLuint vertexArray, GLenum mode,
+                GLsizei count, GLenum indexType, GLsizei instanceCount, GLint uniformLocation, const glm::vec3 &uniformValue)
+    {
+        RenderCommand command;
+        // view:8 | layer:8 | program:24 | vao:24
+        command.key = ((uint64_t)(view & 0xff) << 56) | ((uint64_t)(layer & 0xff) << 48) |
+                      ((uint64_t)(program & 0xffffff) << 24) | (uint64_t)(vertexArray & 0xffffff);
+        command.view = view;
+        command.program = program;
+        command.vertexArray = vertexArray;
+        command.mode = mode;
+        command.count = count;
+        command.indexType = indexType;
+        command.instanceCount = instanceCount;
+        command.uniformLocation = uniformLocation;
+        command.uniformValue = uniformValue;
+        for (unsigned int unit = 0; unit < GLStateCache::MAX_BUFFER_TEXTURES; unit++)
+            command.bufferTextures[unit] = 0;
+        commands.push_back(command);
+    }
+
+    void uploadViews(GLStateCache &state)
+    {
+        if (views.empty())
+            return;
+
+        staging.assign(views.size() * viewStride, 0);
+        for (unsigned int i = 0; i < views.size(); i++)
+        {
+            char* dst = &staging[i * viewStride];
+            std::copy((const char*)&views[i].projection[0][0], (const char*)&views[i].projection[0][0] + sizeof(glm::mat4), dst);
+            std::copy((const char*)&views[i].view[0][0], (const char*)&views[i].view[0][0] + sizeof(glm::mat4), dst + sizeof(glm::mat4));
+        }
+
+        if (ubo == 0)
+            glGenBuffers(1, &ubo);
+        glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+        if (uboViews < views.size())
+        {
+            // growing the buffer gives it a new store, drop the cached ranges pointing into the old one
+            uboViews = views.size();
+            glBufferData(GL_UNIFORM_BUFFER, staging.size(), staging.data(), GL_DYNAMIC_DRAW);
+            state.invalidate();
+        }
+        else
+        {
+            glBufferSubData(GL_UNIFORM_BUFFER, 0, staging.size(), staging.data());
+        }
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+};
+
+#endif
@@ -5,62 +5,53 @@
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 
+#include <learnopengl/filesystem.h>
+
 #include <string>
+#include <unordered_map>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+#include <set>
+#include <memory>
+#include <sys/stat.h>
 
 class Shader
 {
 public:
     unsigned int ID;
-    // constructor generates the shader on the fly
+    // constructor generates the shader on the fly.
+    // sources may #include "file" (relative to the including file) and every entry of defines
+    // ("NAME" or "NAME value") is injected as a #define right after the #version line.
     // ------------------------------------------------------------------------
-    Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
+    Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr,
+           const std::vector<std::string> &defines = std::vector<std::string>())
     {
-        // 1. retrieve the vertex/fragment source code from filePath
-        std::string vertexCode;
-        std::string fragmentCode;
+        // 1. retrieve the vertex/fragment source code from filePath and resolve includes/defines
+        std::string defineBlock = defineDirectives(defines);
+        std::string vertexCode = preprocess(vertexPath, defineBlock);
+        std::string fragmentCode = preprocess(fragmentPath, defineBlock);
         std::string geometryCode;
-        std::ifstream vShaderFile;
-        std::ifstream fShaderFile;
-        std::ifstream gShaderFile;
-        // ensure ifstream objects can throw exceptions:
-        vShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-        fShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-        gShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-        try 
-        {
-            // open files
-            vShaderFile.open(vertexPath);
-            fShaderFile.open(fragmentPath);
-            std::stringstream vShaderStream, fShaderStream;
-            // read file's buffer contents into streams
-            vShaderStream << vShaderFile.rdbuf();
-            fShaderStream << fShaderFile.rdbuf();		
-            // close file handlers
-            vShaderFile.close();
-            fShaderFile.close();
-            // convert stream into string
-            vertexCode = vShaderStream.str();
-            fragmentCode = fShaderStream.str();			
-            // if geometry shader path is present, also load a geometry shader
-            if(geometryPath != nullptr)
-            {
-                gShaderFile.open(geometryPath);
-                std::stringstream gShaderStream;
-                gShaderStream << gShaderFile.rdbuf();
-                gShaderFile.close();
-                geometryCode = gShaderStream.str();
-            }
-        }
-        catch (std::ifstream::failure& e)
+        // if geometry shader path is present, also load a geometry shader
+        if(geometryPath != nullptr)
+            geometryCode = preprocess(geometryPath, defineBlock);
+        // 2. a program linked earlier from the same sources on the same driver can be loaded as a binary
+        std::string cacheKey = programCacheKey(vertexCode, fragmentCode, geometryCode, defineBlock);
+        double startTime = glfwGetTime();
+        ID = glCreateProgram();
+        if (loadProgramBinary(cacheKey))
         {
-            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+            cacheUniformLocations();
+            std::cout << "shader " << vertexPath << ": loaded cached program binary in "
+                      << (glfwGetTime() - startTime) * 1000.0 << "ms" << std::endl;
+            return;
         }
         const char* vShaderCode = vertexCode.c_str();
         const char * fShaderCode = fragmentCode.c_str();
-        // 2. compile shaders
+        // 3. compile shaders
         unsigned int vertex, fragment;
         // vertex shader
         vertex = glCreateShader(GL_VERTEX_SHADER);
@@ -83,19 +74,56 @@ public:
             checkCompileErrors(geometry, "GEOMETRY");
         }
         // shader Program
-        ID = glCreateProgram();
         glAttachShader(ID, vertex);
         glAttachShader(ID, fragment);
         if(geometryPath != nullptr)
             glAttachShader(ID, geometry);
+        if (programBinarySupported())
+            glProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
         glLinkProgram(ID);
         checkCompileErrors(ID, "PROGRAM");
+        cacheUniformLocations();
         // delete the shaders as they're linked into our program now and no longer necessery
         glDeleteShader(vertex);
         glDeleteShader(fragment);
         if(geometryPath != nullptr)
             glDeleteShader(geometry);
-
+        std::cout << "shader " << vertexPath << ": compiled and linked from source in "
+                  << (glfwGetTime() - startTime) * 1000.0 << "ms" << std::endl;
+        // 4. store the linked program for the next launch
+        saveProgramBinary(cacheKey);
+    }
+    // compute-only program, needs GL 4.3 (or ARB_compute_shader); same include/define handling
+    // ------------------------------------------------------------------------
+    explicit Shader(const char* computePath, const std::vector<std::string> &defines = std::vector<std::string>())
+    {
+        std::string defineBlock = defineDirectives(defines);
+        std::string computeCode = preprocess(computePath, defineBlock);
+        std::string cacheKey = programCacheKey(computeCode, "", "", defineBlock + "#compute\n");
+        double startTime = glfwGetTime();
+        ID = glCreateProgram();
+        if (loadProgramBinary(cacheKey))
+        {
+            cacheUniformLocations();
+            std::cout << "shader " << computePath << ": loaded cached program binary in "
+                      << (glfwGetTime() - startTime) * 1000.0 << "ms" << std::endl;
+            return;
+        }
+        const char* cShaderCode = computeCode.c_str();
+        unsigned int compute = glCreateShader(GL_COMPUTE_SHADER);
+        glShaderSource(compute, 1, &cShaderCode, NULL);
+        glCompileShader(compute);
+        checkCompileErrors(compute, "COMPUTE");
+        glAttachShader(ID, compute);
+        if (programBinarySupported())
+            glProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(ID);
+        checkCompileErrors(ID, "PROGRAM");
+        cacheUniformLocations();
+        glDeleteShader(compute);
+        std::cout << "shader " << computePath << ": compiled and linked from source in "
+                  << (glfwGetTime() - startTime) * 1000.0 << "ms" << std::endl;
+        saveProgramBinary(cacheKey);
     }
     // activate the shader
     // ------------------------------------------------------------------------
@@ -103,66 +131,341 @@ public:
     { 
         glUseProgram(ID); 
     }
+    // uniform locations are resolved once at link time, look one up to skip the name lookup on every set.
+    // names not seen at link time (e.g. "array[3]") are queried once and remembered.
+    // ------------------------------------------------------------------------
+    GLint getUniformLocation(const std::string &name) const
+    {
+        std::unordered_map<std::string, GLint>::const_iterator it = uniformLocations.find(name);
+        if (it != uniformLocations.end())
+            return it->second;
+        GLint location = glGetUniformLocation(ID, name.c_str());
+        uniformLocations[name] = location;
+        return location;
+    }
+    // ------------------------------------------------------------------------
+    void bindUniformBlock(const std::string &name, unsigned int binding) const
+    {
+        GLuint blockIndex = glGetUniformBlockIndex(ID, name.c_str());
+        if (blockIndex != GL_INVALID_INDEX)
+            glUniformBlockBinding(ID, blockIndex, binding);
+    }
     // utility uniform functions
     // ------------------------------------------------------------------------
     void setBool(const std::string &name, bool value) const
     {         
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value); 
+        glUniform1i(getUniformLocation(name), (int)value); 
     }
     // ------------------------------------------------------------------------
     void setInt(const std::string &name, int value) const
     { 
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value); 
+        glUniform1i(getUniformLocation(name), value); 
+    }
+    // ------------------------------------------------------------------------
+    void setUint(const std::string &name, unsigned int value) const
+    { 
+        glUniform1ui(getUniformLocation(name), value); 
     }
     // ------------------------------------------------------------------------
     void setFloat(const std::string &name, float value) const
     { 
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value); 
+        glUniform1f(getUniformLocation(name), value); 
+    }
+    void setFloat(GLint location, float value) const
+    { 
+        glUniform1f(location, value); 
     }
     // ------------------------------------------------------------------------
     void setVec2(const std::string &name, const glm::vec2 &value) const
     { 
-        glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        glUniform2fv(getUniformLocation(name), 1, &value[0]); 
     }
     void setVec2(const std::string &name, float x, float y) const
     { 
-        glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y); 
+        glUniform2f(getUniformLocation(name), x, y); 
     }
     // ------------------------------------------------------------------------
     void setVec3(const std::string &name, const glm::vec3 &value) const
     { 
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        glUniform3fv(getUniformLocation(name), 1, &value[0]); 
     }
     void setVec3(const std::string &name, float x, float y, float z) const
     { 
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z); 
+        glUniform3f(getUniformLocation(name), x, y, z); 
+    }
+    void setVec3(GLint location, const glm::vec3 &value) const
+    { 
+        glUniform3fv(location, 1, &value[0]); 
     }
     // ------------------------------------------------------------------------
     void setVec4(const std::string &name, const glm::vec4 &value) const
     { 
-        glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        glUniform4fv(getUniformLocation(name), 1, &value[0]); 
     }
     void setVec4(const std::string &name, float x, float y, float z, float w) 
     { 
-        glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w); 
+        glUniform4f(getUniformLocation(name), x, y, z, w); 
     }
     // ------------------------------------------------------------------------
     void setMat2(const std::string &name, const glm::mat2 &mat) const
     {
-        glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix2fv(getUniformLocation(name), 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
     void setMat3(const std::string &name, const glm::mat3 &mat) const
     {
-        glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix3fv(getUniformLocation(name), 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
     void setMat4(const std::string &name, const glm::mat4 &mat) const
     {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix4fv(getUniformLocation(name), 1, GL_FALSE, &mat[0][0]);
+    }
+    void setMat4(GLint location, const glm::mat4 &mat) const
+    {
+        glUniformMatrix4fv(location, 1, GL_FALSE, &mat[0][0]);
     }
 
 private:
+    mutable std::unordered_map<std::string, GLint> uniformLocations;
+
+    // query every active uniform of the linked program and remember its location.
+    // uniforms inside a uniform block have no location and are skipped.
+    // ------------------------------------------------------------------------
+    void cacheUniformLocations()
+    {
+        uniformLocations.clear();
+        GLint count = 0;
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+        for (GLint i = 0; i < count; i++)
+        {
+            GLchar name[256];
+            GLsizei length = 0;
+            GLint size = 0;
+            GLenum type;
+            glGetActiveUniform(ID, i, sizeof(name), &length, &size, &type, name);
+            GLint location = glGetUniformLocation(ID, name);
+            if (location < 0)
+                continue;
+            std::string uniformName(name, length);
+            uniformLocations[uniformName] = location;
+            // arrays are reported as "name[0]", also make them reachable as "name"
+            std::string::size_type bracket = uniformName.find('[');
+            if (bracket != std::string::npos)
+                uniformLocations[uniformName.substr(0, bracket)] = location;
+        }
+    }
+
+    // "NAME value" -> "#define NAME value"
+    // ------------------------------------------------------------------------
+    static std::string defineDirectives(const std::vector<std::string> &defines)
+    {
+        std::string block;
+        for (const std::string &define : defines)
+            block += "#define " + define + "\n";
+        return block;
+    }
+
+    // through FileSystem, so shaders come out of the asset archive when one is mounted
+    static std::string readFile(const std::string &path)
+    {
+        Asset file = FileSystem::open(path);
+        if (!file.valid())
+            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ: " << path << std::endl;
+        return file.str();
+    }
+
+    // expand #include "file" recursively (each file once) and put the defines after #version.
+    // #line directives keep compiler messages pointing at the original line, the source string
+    // number tells which file it was (0 = the shader itself, then in order of inclusion).
+    // ------------------------------------------------------------------------
+    static std::string preprocess(const std::string &path, const std::string &defineBlock)
+    {
+        std::set<std::string> included;
+        int fileCount = 0;
+        return expandIncludes(path, defineBlock, included, fileCount);
+    }
+
+    static std::string expandIncludes(const std::string &path, const std::string &defineBlock,
+                                      std::set<std::string> &included, int &fileCount)
+    {
+        included.insert(path);
+        int fileIndex = fileCount++;
+        std::string directory;
+        std::string::size_type slash = path.find_last_of('/');
+        if (slash != std::string::npos)
+            directory = path.substr(0, slash + 1);
+
+        std::stringstream source(readFile(path));
+        std::stringstream output;
+        std::string line;
+        int lineNumber = 0;
+        while (std::getline(source, line))
+        {
+            lineNumber++;
+            std::string::size_type first = line.find_first_not_of(" \t");
+            std::string directive = first != std::string::npos ? line.substr(first) : std::string();
+
+            if (directive.compare(0, 8, "#version") == 0)
+            {
+                output << line << "\n" << defineBlock
+                       << "#line " << lineNumber + 1 << " " << fileIndex << "\n";
+            }
+            else if (directive.compare(0, 8, "#include") == 0)
+            {
+                std::string::size_type open = directive.find('"');
+                std::string::size_type close = directive.find('"', open + 1);
+                if (open == std::string::npos || close == std::string::npos)
+                {
+                    std::cout << "ERROR::SHADER::BAD_INCLUDE: " << path << ":" << lineNumber << std::endl;
+                    continue;
+                }
+                std::string includePath = directory + directive.substr(open + 1, close - open - 1);
+                if (included.count(includePath) == 0)
+                {
+                    output << "#line 1 " << fileCount << "\n"
+                           << expandIncludes(includePath, defineBlock, included, fileCount)
+                           << "#line " << lineNumber + 1 << " " << fileIndex << "\n";
+                }
+            }
+            else
+            {
+                output << line << "\n";
+            }
+        }
+        return output.str();
+    }
+
+    // linked program binaries are stored as shader_cache/<key>.bin next to the executable, so the
+    // cache doesn't depend on the working directory (the working directory when that can't be found)
+    // ------------------------------------------------------------------------
+    static const std::string &programCacheDirectory()
+    {
+        static std::string directory = FileSystem::executableDirectory().empty()
+                                           ? std::string("shader_cache")
+                                           : FileSystem::executableDirectory() + "/shader_cache";
+        return directory;
+    }
+
+    static bool programBinarySupported()
+    {
+        static int supported = -1;
+        if (supported < 0)
+        {
+            GLint formats = 0;
+            if (GLEW_ARB_get_program_binary)
+                glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+            supported = formats > 0 ? 1 : 0;
+        }
+        return supported == 1;
+    }
+
+    // 64-bit FNV-1a over every source, the injected defines and the driver vendor/renderer/version,
+    // so a driver update or any source change produces a new key
+    // ------------------------------------------------------------------------
+    static std::string programCacheKey(const std::string &vertexCode, const std::string &fragmentCode,
+                                       const std::string &geometryCode, const std::string &defines)
+    {
+        const char* driver[] = {
+            (const char*)glGetString(GL_VENDOR),
+            (const char*)glGetString(GL_RENDERER),
+            (const char*)glGetString(GL_VERSION)
+        };
+        uint64_t hash = 14695981039346656037ull;
+        for (const char* part : driver)
+            hash = hashBytes(hash, part != nullptr ? std::string(part) : std::string());
+        hash = hashBytes(hash, defines);
+        hash = hashBytes(hash, vertexCode);
+        hash = hashBytes(hash, fragmentCode);
+        hash = hashBytes(hash, geometryCode);
+
+        char key[17];
+        snprintf(key, sizeof(key), "%016llx", (unsigned long long)hash);
+        return std::string(key);
+    }
+
+    static uint64_t hashBytes(uint64_t hash, const std::string &bytes)
+    {
+        for (unsigned char c : bytes)
+        {
+            hash ^= c;
+            hash *= 1099511628211ull;
+        }
+        // terminate every part so "ab"+"c" and "a"+"bc" hash differently
+        hash ^= 0xff;
+        hash *= 1099511628211ull;
+        return hash;
+    }
+
+    // cache file layout: "PGKB", binary format, binary length, binary
+    // ------------------------------------------------------------------------
+    bool loadProgramBinary(const std::string &key)
+    {
+        if (!programBinarySupported())
+            return false;
+
+        std::ifstream file(programCacheDirectory() + "/" + key + ".bin", std::ios::binary);
+        if (!file)
+            return false;
+
+        char magic[4];
+        uint32_t format = 0;
+        uint32_t length = 0;
+        file.read(magic, sizeof(magic));
+        file.read((char*)&format, sizeof(format));
+        file.read((char*)&length, sizeof(length));
+        if (!file || std::string(magic, sizeof(magic)) != "PGKB" || length == 0)
+            return false;
+
+        std::vector<char> binary(length);
+        if (!file.read(binary.data(), length))
+            return false;
+
+        glProgramBinary(ID, format, binary.data(), length);
+        GLint success = 0;
+        glGetProgramiv(ID, GL_LINK_STATUS, &success);
+        if (!success)
+        {
+            // the driver may reject binaries it produced itself (e.g. after an update), recompile
+            std::cout << "shader cache: program binary " << key << " rejected, compiling from source" << std::endl;
+            glDeleteProgram(ID);
+            ID = glCreateProgram();
+            return false;
+        }
+        return true;
+    }
+
+    void saveProgramBinary(const std::string &key) const
+    {
+        if (!programBinarySupported())
+            return;
+
+        GLint success = 0;
+        glGetProgramiv(ID, GL_LINK_STATUS, &success);
+        if (!success)
+            return;
+
+        GLint length = 0;
+        glGetProgramiv(ID, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+            return;
+
+        std::vector<char> binary(length);
+        GLenum format = 0;
+        glGetProgramBinary(ID, length, NULL, &format, binary.data());
+
+        mkdir(programCacheDirectory().c_str(), 0755);
+        std::ofstream file(programCacheDirectory() + "/" + key + ".bin", std::ios::binary | std::ios::trunc);
+        if (!file)
+            return;
+        uint32_t format32 = format;
+        uint32_t length32 = length;
+        file.write("PGKB", 4);
+        file.write((const char*)&format32, sizeof(format32));
+        file.write((const char*)&length32, sizeof(length32));
+        file.write(binary.data(), length);
+    }
+
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
     void checkCompileErrors(GLuint shader, std::string type)
@@ -189,4 +492,28 @@ private:
         }
     }
 };
+
+// compiled shader permutations keyed by (vertex, fragment, defines); asking for the same
+// combination twice returns the program built the first time
+// ------------------------------------------------------------------------
+class ShaderPermutations
+{
+public:
+    Shader& get(const char* vertexPath, const char* fragmentPath,
+                const std::vector<std::string> &defines = std::vector<std::string>())
+    {
+        std::set<std::string> sortedDefines(defines.begin(), defines.end());
+        std::string key = std::string(vertexPath) + "|" + fragmentPath;
+        for (const std::string &define : sortedDefines)
+            key += "|" + define;
+
+        std::unique_ptr<Shader> &shader = shaders[key];
+        if (!shader)
+            shader.reset(new Shader(vertexPath, fragmentPath, nullptr, defines));
+        return *shader;
+    }
+
+private:
+    std::unordered_map<std::string, std::unique_ptr<Shader>> shaders;
+};
 #endif
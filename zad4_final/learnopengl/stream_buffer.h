@@ -0,0 +1,168 @@
+#ifndef STREAM_BUFFER_H
+#define STREAM_BUFFER_H
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include <learnopengl/gl_owner.h>
+
+#include <iostream>
+
+// Ring buffer for data written by the CPU every frame (debug markers, culling output, dynamic instances).
+// The buffer is split into one region per frame in flight. A region is fenced once the frame that
+// used it has been submitted, and it is only written again after that fence has signaled, so writes
+// never touch memory the GPU may still read. With ARB_buffer_storage the whole buffer is created
+// with glBufferStorage and stays persistently mapped; without it each region is mapped unsynchronized
+// for the frame and unmapped before drawing.
+class StreamBuffer : private GLOwner
+{
+public:
+    // time spent waiting for the GPU when the ring wrapped onto a region that was still in use
+    double stallTime;
+    unsigned int stalls;
+
+    StreamBuffer(GLenum target, GLsizeiptr regionSize, unsigned int framesInFlight = 3)
+        : stallTime(0.0), stalls(0), target(target), regionSize(regionSize), regionCount(framesInFlight),
+          region(0), cursor(0), mapped(nullptr), persistent(GLEW_ARB_buffer_storage)
+    {
+        fences = new GLsync[regionCount];
+        for (unsigned int i = 0; i < regionCount; i++)
+            fences[i] = 0;
+
+        glGenBuffers(1, &ID);
+        glBindBuffer(target, ID);
+        if (persistent)
+        {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(target, regionSize * regionCount, NULL, flags);
+            base = (char*)glMapBufferRange(target, 0, regionSize * regionCount, flags);
+        }
+        else
+        {
+            glBufferData(target, regionSize * regionCount, NULL, GL_STREAM_DRAW);
+            base = nullptr;
+        }
+        glBindBuffer(target, 0);
+    }
+
+    ~StreamBuffer()
+    {
+        if (!glReleasable())
+        {
+            delete[] fences;
+            return;
+        }
+
+        for (unsigned int i = 0; i < regionCount; i++)
+            if (fences[i] != 0)
+                glDeleteSync(fences[i]);
+        delete[] fences;
+
+        if (persistent)
+        {
+            glBindBuffer(target, ID);
+            glUnmapBuffer(target);
+            glBindBuffer(target, 0);
+        }
+        glDeleteBuffers(1, &ID);
+    }
+
+    GLuint buffer() const
+    {
+        return ID;
+    }
+
+    GLsizeiptr capacity() const
+    {
+        return regionSize;
+    }
+
+    // wait until the GPU is done with this frame's region and make it writable
+    // ------------------------------------------------------------------------
+    void beginFrame()
+    {
+        if (fences[region] != 0)
+        {
+            GLenum status = glClientWaitSync(fences[region], 0, 0);
+            if (status == GL_TIMEOUT_EXPIRED)
+            {
+                double startTime = glfwGetTime();
+                while (status == GL_TIMEOUT_EXPIRED)
+                    status = glClientWaitSync(fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+                stallTime += glfwGetTime() - startTime;
+                stalls++;
+            }
+            glDeleteSync(fences[region]);
+            fences[region] = 0;
+        }
+
+        cursor = 0;
+        if (persistent)
+        {
+            mapped = base + region * regionSize;
+        }
+        else
+        {
+            glBindBuffer(target, ID);
+            mapped = (char*)glMapBufferRange(target, region * regionSize, regionSize,
+                                             GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+            glBindBuffer(target, 0);
+        }
+    }
+
+    // reserve size bytes in this frame's region; offset is relative to the start of the buffer.
+    // returns nullptr when the region is full.
+    // ------------------------------------------------------------------------
+    void* allocate(GLsizeiptr size, GLsizeiptr alignment, GLintptr &offset)
+    {
+        GLsizeiptr start = ((cursor + alignment - 1) / alignment) * alignment;
+        if (mapped == nullptr || start + size > regionSize)
+            return nullptr;
+
+        cursor = start + size;
+        offset = region * regionSize + start;
+        return mapped + start;
+    }
+
+    // writes are done, the region may be used by draws (unmaps in the fallback path)
+    // ------------------------------------------------------------------------
+    void finishWrites()
+    {
+        if (!persistent && mapped != nullptr)
+        {
+            glBindBuffer(target, ID);
+            glUnmapBuffer(target);
+            glBindBuffer(target, 0);
+        }
+        mapped = nullptr;
+    }
+
+    // all draws reading this frame's region have been submitted: fence it and move to the next one
+    // ------------------------------------------------------------------------
+    void endFrame()
+    {
+        finishWrites();
+        fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        region = (region + 1) % regionCount;
+    }
+
+    void printStats(const char* name) const
+    {
+        std::cout << "stream buffer " << name << ": " << regionCount << " x " << regionSize / 1024 << "KB"
+                  << (persistent ? " persistent" : " mapped per frame") << ", " << stalls << " stalls, "
+                  << stallTime * 1000.0 << "ms waiting for the GPU" << std::endl;
+    }
+
+private:
+    GLuint ID;
+    GLenum target;
+    GLsizeiptr regionSize;
+    unsigned int regionCount;
+    unsigned int region;
+    GLsizeiptr cursor;
+    char* base;
+    char* mapped;
+    bool persistent;
+    GLsync* fences;
+};
+
+#endif
@@ -0,0 +1,158 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <stb_image.h>
+
+#include <learnopengl/filesystem.h>
+#include <learnopengl/mip_chain.h>
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <iostream>
+
+// an image with its whole mip chain, finest level first: BC3 compressed from "<image>.bc.mips" when
+// there is one, and as RGBA8 when there isn't or when the holder asked for it; levels stays empty
+// for an image read with its BC3 chain only
+struct CachedImage
+{
+    std::string path;
+    int width;
+    int height;
+    std::vector<MipLevel> levels;
+    std::vector<MipLevel> compressed;
+    size_t bytes;
+};
+
+// Process-wide cache of decoded images keyed by FileSystem::canonicalPath, so every model that uses
+// a file shares one decoded copy (the GL side is shared separately, see MaterialLibrary). Holders
+// keep an image alive through their shared_ptr (the reference count); the cache itself only keeps
+// weak references, an image nobody holds any more is decoded again on the next acquire. Safe to use
+// from the ModelLoader worker threads.
+// The mip chains come from the "<image>.bc.mips" and "<image>.mips" files texpack writes; the RGBA8
+// one is only read when there is no BC3 one or the holder can't use it. An image without either (or
+// with ones older than the image) is decoded with stb and its chain built here, on the calling
+// thread. Images and chains are read through FileSystem, from the asset archive when one is mounted.
+class TextureCache
+{
+public:
+    static TextureCache &instance()
+    {
+        static TextureCache cache;
+        return cache;
+    }
+
+    // the decoded image of a file, or nullptr if it can't be read; key is the file's
+    // FileSystem::canonicalPath, which callers already need for their own lookups. rgba asks for the
+    // RGBA8 chain even if there is a BC3 one, for a holder that can't upload compressed textures
+    // ------------------------------------------------------------------------
+    std::shared_ptr<const CachedImage> acquire(const std::string &key, bool rgba)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::shared_ptr<const CachedImage> image = find(key);
+            if (image && (!rgba || !image->levels.empty()))
+            {
+                hits++;
+                savedBytes += image->bytes;
+                return image;
+            }
+        }
+
+        // decode without the lock, other threads may be decoding other files meanwhile
+        std::shared_ptr<CachedImage> decoded(new CachedImage());
+        decoded->path = key;
+        readMipFile(key + ".bc.mips", key, MIP_BC3, decoded->compressed);
+        bool needRGBA = rgba || decoded->compressed.empty();
+        bool precomputed = !needRGBA || readMipFile(key + ".mips", key, MIP_RGBA8, decoded->levels);
+        if (!precomputed)
+        {
+            int width, height, components;
+            Asset file = FileSystem::open(key);
+            unsigned char* data = file.valid() ? stbi_load_from_memory((const stbi_uc*)file.data(), (int)file.size(), &width, &height, &components, 4)
+                                               : nullptr;
+            if (data == nullptr)
+            {
+                std::cout << "Texture failed to load at path: " << key << std::endl;
+                return nullptr;
+            }
+            decoded->levels = buildMipChain(data, width, height);
+            stbi_image_free(data);
+        }
+        const std::vector<MipLevel> &finest = decoded->levels.empty() ? decoded->compressed : decoded->levels;
+        decoded->width = finest[0].width;
+        decoded->height = finest[0].height;
+        if (!decoded->compressed.empty() &&
+            (decoded->compressed[0].width != decoded->width || decoded->compressed[0].height != decoded->height))
+            decoded->compressed.clear();
+        decoded->bytes = 0;
+        for (const MipLevel &level : decoded->levels)
+            decoded->bytes += level.data.size();
+        for (const MipLevel &level : decoded->compressed)
+            decoded->bytes += level.data.size();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        // another thread may have decoded the same file in the meantime, keep the first copy; the
+        // decoding was done twice then, so it isn't counted as a hit
+        std::shared_ptr<const CachedImage> image = find(key);
+        if (image && (!rgba || !image->levels.empty()))
+        {
+            duplicateDecodes++;
+            return image;
+        }
+        images[key] = decoded;
+        misses++;
+        if (precomputed)
+            precomputedChains++;
+        if (decoded->levels.empty())
+            compressedOnly++;
+        decodedBytes += decoded->bytes;
+        return decoded;
+    }
+
+    void printStats() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::cout << "texture cache: " << misses << " images loaded (" << decodedBytes / 1024 << "KB with mip chains, "
+                  << precomputedChains << " chains precomputed by texpack, " << compressedOnly << " BC3 only), " << hits << " shared, "
+                  << savedBytes / 1024 << "KB of decoding saved, " << duplicateDecodes << " decoded twice by racing threads" << std::endl;
+    }
+
+private:
+    mutable std::mutex mutex;
+    std::unordered_map<std::string, std::weak_ptr<const CachedImage> > images;
+    size_t hits;
+    size_t misses;
+    size_t precomputedChains;
+    size_t decodedBytes;
+    size_t savedBytes;
+    size_t duplicateDecodes;
+    size_t compressedOnly;
+
+    TextureCache() : hits(0), misses(0), precomputedChains(0), decodedBytes(0), savedBytes(0), duplicateDecodes(0),
+                     compressedOnly(0)
+    {
+    }
+
+    // the lock has to be held
+    std::shared_ptr<const CachedImage> find(const std::string &key)
+    {
+        std::unordered_map<std::string, std::weak_ptr<const CachedImage> >::iterator it = images.find(key);
+        if (it == images.end())
+            return nullptr;
+        std::shared_ptr<const CachedImage> image = it->second.lock();
+        if (!image)
+        {
+            images.erase(it);
+            return nullptr;
+        }
+        return image;
+    }
+
+    TextureCache(const TextureCache&);
+    TextureCache& operator=(const TextureCache&);
+};
+
+#endif
@@ -0,0 +1,91 @@
+// Level layout and counter-based generation, shared by levelgen.comp and the CPU (level.h).
+// Written in the subset of GLSL that glm also understands, so both sides run the same code.
+// Every instance only depends on (seed, N, index), so any instance can be generated on its own.
+
+// instance index -> cell (x fastest, then y, then z) of the N*N*N grid spanning [-1, 1]
+vec3 instanceTranslation(uint index, uint N)
+{
+    int x = int(index % N);
+    int y = int((index / N) % N);
+    int z = int(index / (N * N));
+    float offset = 1.0f / float(N);
+    return vec3(float(2 * x - int(N)) / float(N) + offset,
+                float(2 * y - int(N)) / float(N) + offset,
+                float(2 * z - int(N)) / float(N) + offset);
+}
+
+// lowbias32 integer hash
+uint hashUint(uint x)
+{
+    x ^= x >> 16u;
+    x *= 0x7feb352du;
+    x ^= x >> 15u;
+    x *= 0x846ca68bu;
+    x ^= x >> 16u;
+    return x;
+}
+
+// whole degrees in [0, 360) around x, y and z, like the rand() % 360 levels used to have
+vec3 instanceEulerDegrees(uint seed, uint index)
+{
+    uint h = hashUint((seed * 0x9e3779b9u) ^ index);
+    return vec3(float(hashUint(h) % 360u),
+                float(hashUint(h + 1u) % 360u),
+                float(hashUint(h + 2u) % 360u));
+}
+
+// euler angles (radians, x then y then z) -> quaternion (x, y, z, w), same as glm::quat(vec3)
+vec4 eulerToQuat(vec3 angles)
+{
+    vec3 c = cos(angles * 0.5f);
+    vec3 s = sin(angles * 0.5f);
+    return vec4(s.x * c.y * c.z - c.x * s.y * s.z,
+                c.x * s.y * c.z + s.x * c.y * s.z,
+                c.x * c.y * s.z - s.x * s.y * c.z,
+                c.x * c.y * c.z + s.x * s.y * s.z);
+}
+
+vec4 instanceRotation(uint seed, uint index)
+{
+    return eulerToQuat(radians(instanceEulerDegrees(seed, index)));
+}
+
+// spinning levels: every instance turns around its own axis at a whole number of turns per
+// SPIN_PERIOD seconds, so the whole level repeats after SPIN_PERIOD and the clock can wrap there
+// without a jump. Keeping the time small also keeps sin/cos equally precise on the CPU and the GPU.
+const float SPIN_PERIOD = 60.0f;
+
+// axis * angular speed in radians per second
+vec3 instanceAngularVelocity(uint seed, uint index)
+{
+    uint h = hashUint((seed * 0x85ebca6bu) ^ hashUint(index + 0x632be5abu));
+    float z = float(hashUint(h) & 0xffffu) / 32767.5f - 1.0f;
+    float phi = float(hashUint(h + 1u) & 0xffffu) * (6.28318531f / 65536.0f);
+    float r = sqrt(max(0.0f, 1.0f - z * z));
+    float turns = float(6u + hashUint(h + 2u) % 25u);
+    // float() on each component: as C++, cos and sin may resolve to the double overloads
+    return vec3(float(r * cos(phi)), float(r * sin(phi)), z) * (turns * 6.28318531f / SPIN_PERIOD);
+}
+
+// hamilton product of quaternions (x, y, z, w)
+vec4 quatMul(vec4 a, vec4 b)
+{
+    vec3 av = vec3(a.x, a.y, a.z);
+    vec3 bv = vec3(b.x, b.y, b.z);
+    vec3 v = a.w * bv + b.w * av + cross(av, bv);
+    return vec4(v.x, v.y, v.z, a.w * b.w - dot(av, bv));
+}
+
+// rotation of the instance time seconds into the level (0 <= time < SPIN_PERIOD), integrated in
+// closed form from the generated rotation, so any frame can be computed without the previous one
+vec4 animatedRotation(uint seed, uint index, float time)
+{
+    vec3 omega = instanceAngularVelocity(seed, index);
+    float speed = length(omega);
+    float halfAngle = 0.5f * speed * time;
+    vec3 axis = omega / speed;
+    float sinHalf = float(sin(halfAngle));
+    float cosHalf = float(cos(halfAngle));
+    vec4 spin = vec4(axis.x * sinHalf, axis.y * sinHalf, axis.z * sinHalf, cosHalf);
+    return quatMul(instanceRotation(seed, index), spin);
+}
@@ -0,0 +1,224 @@
+#ifndef LEVEL_H
+#define LEVEL_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "learnopengl/shader.h"
+#include "quaternion.h"
+#include "collision.h"
+#include "instance_pages.h"
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <iostream>
+#include <cmath>
+
+// level.glsl is valid C++ against glm, the CPU generator runs the same code as levelgen.comp
+namespace glsl
+{
+    using namespace glm;
+    typedef unsigned int uint;
+    #include "level.glsl"
+}
+
+using glsl::instanceTranslation;
+using glsl::instanceRotation;
+using glsl::animatedRotation;
+using glsl::SPIN_PERIOD;
+
+// the shaders number instances with 32-bit uints: the largest N whose N*N*N indices fit, N is checked
+// against it wherever it's read, so the (unsigned int) index casts below never truncate
+const unsigned int MAX_LEVEL_SIZE = 1625;
+
+// collision triangle of one instance: the base triangle rotated and moved to the instance
+// ---------------------------------------------------------------------------------------------------------
+inline Triangle instanceTriangle(const glm::mat3 &baseTriangle, glm::vec3 translation, glm::vec4 rotation)
+{
+    glm::mat3 rotatedTriangle = quatToMat3(rotation) * baseTriangle;
+    return Triangle(translation + rotatedTriangle[0], translation + rotatedTriangle[1], translation + rotatedTriangle[2]);
+}
+
+// fill every page of instances on the GPU with levelgen.comp, nothing is uploaded
+// ---------------------------------------------------------------------------------------------------------
+inline void generateLevelOnGpu(Shader &levelShader, InstancePages &instancePages, unsigned int seed, unsigned int N)
+{
+    levelShader.use();
+    levelShader.setUint("seed", seed);
+    levelShader.setUint("N", N);
+
+    for (const InstancePages::Page &page : instancePages.pages)
+    {
+        levelShader.setUint("count", (unsigned int)page.count);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, page.translationVBO);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, page.rotationVBO);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, page.indexVBO);
+        glDispatchCompute((page.count + 255) / 256, 1, 1);
+    }
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, 0);
+    glUseProgram(0);
+
+    // the buffers are read as vertex attributes, through buffer textures by vertex pulling and, for the
+    // cross-check, with glGetBufferSubData
+    glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+}
+
+// rewrite the rotation of every instance for the given time with levelspin.comp
+// ---------------------------------------------------------------------------------------------------------
+inline void spinLevelOnGpu(Shader &spinShader, InstancePages &instancePages, unsigned int seed, float time)
+{
+    spinShader.use();
+    spinShader.setUint("seed", seed);
+    spinShader.setFloat("time", time);
+
+    for (const InstancePages::Page &page : instancePages.pages)
+    {
+        spinShader.setUint("count", (unsigned int)page.count);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, page.rotationVBO);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, page.indexVBO);
+        glDispatchCompute((page.count + 255) / 256, 1, 1);
+    }
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, 0);
+    glUseProgram(0);
+
+    glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+}
+
+// read instances back from the GPU and compare them with the CPU generator: the whole level
+// up to sampleLimit instances, a strided sample of about sampleLimit instances beyond that; slotIndices
+// gives the instance index of every slot of the pages.
+// returns the largest difference of any component.
+// ---------------------------------------------------------------------------------------------------------
+inline float crossCheckLevel(const InstancePages &instancePages, const unsigned int* slotIndices, unsigned int seed,
+                             unsigned int N, size_t sampleLimit, size_t &compared)
+{
+    size_t stride = std::max<size_t>(1, instancePages.instanceCount() / sampleLimit);
+    float maxDifference = 0.0f;
+    compared = 0;
+
+    size_t firstInstance = 0;
+    std::vector<glm::vec3> translations;
+    std::vector<glm::vec4> rotations;
+    for (const InstancePages::Page &page : instancePages.pages)
+    {
+        translations.resize(page.count);
+        rotations.resize(page.count);
+        glBindBuffer(GL_ARRAY_BUFFER, page.translationVBO);
+        glGetBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(glm::vec3) * page.count, translations.data());
+        glBindBuffer(GL_ARRAY_BUFFER, page.rotationVBO);
+        glGetBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(glm::vec4) * page.count, rotations.data());
+
+        for (size_t i = (stride - firstInstance % stride) % stride; i < page.count; i += stride)
+        {
+            unsigned int index = slotIndices[firstInstance + i];
+            glm::vec3 translation = instanceTranslation(index, N);
+            glm::vec4 rotation = instanceRotation(seed, index);
+            for (int k = 0; k < 3; k++)
+                maxDifference = std::max(maxDifference, std::fabs(translations[i][k] - translation[k]));
+            for (int k = 0; k < 4; k++)
+                maxDifference = std::max(maxDifference, std::fabs(rotations[i][k] - rotation[k]));
+            compared++;
+        }
+        firstInstance += page.count;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return maxDifference;
+}
+
+// Collision triangles built lazily, only for the grid cells a sphere can reach. Used when the
+// level is generated on the GPU and the CPU never builds the full triangle list, and for spinning
+// levels, where the triangles change every frame; any instance can be rebuilt from
+// (seed, N, index, time) alone.
+class NeighborhoodCollider
+{
+public:
+    // instance indices found by the last query
+    std::vector<size_t> nearby;
+
+    NeighborhoodCollider(unsigned int seed, unsigned int N, size_t instanceCount, const glm::mat3 &baseTriangle)
+        : seed(seed), N(N), instanceCount(instanceCount), baseTriangle(baseTriangle), reach(0.0f), time(0.0f)
+    {
+        // farthest a triangle vertex gets from its instance center, whatever the rotation
+        for (int i = 0; i < 3; i++)
+            reach = std::max(reach, glm::length(baseTriangle[i]));
+    }
+
+    // time of a spinning level the triangles are built for, the cached ones are stale once it changes
+    // ------------------------------------------------------------------------
+    void setTime(float levelTime)
+    {
+        if (levelTime == time)
+            return;
+        time = levelTime;
+        cache.clear();
+    }
+
+    // collect every instance whose triangle can touch a sphere at center with the given radius
+    // ------------------------------------------------------------------------
+    void query(glm::vec3 center, float radius)
+    {
+        nearby.clear();
+
+        int lo[3], hi[3];
+        for (int k = 0; k < 3; k++)
+        {
+            // cell c has its center at (2c + 1) / N - 1
+            lo[k] = std::max(0, (int)std::ceil(((center[k] - radius - reach + 1.0f) * N - 1.0f) / 2.0f));
+            hi[k] = std::min((int)N - 1, (int)std::floor(((center[k] + radius + reach + 1.0f) * N - 1.0f) / 2.0f));
+        }
+
+        for (int z = lo[2]; z <= hi[2]; z++)
+            for (int y = lo[1]; y <= hi[1]; y++)
+                for (int x = lo[0]; x <= hi[0]; x++)
+                {
+                    size_t index = ((size_t)z * N + y) * N + x;
+                    if (index < instanceCount)
+                        nearby.push_back(index);
+                }
+
+        // forget triangles the sphere has left behind once the cache gets big
+        if (cache.size() > 4 * nearby.size() + 4096)
+        {
+            std::unordered_map<size_t, Triangle> kept;
+            for (size_t index : nearby)
+            {
+                std::unordered_map<size_t, Triangle>::iterator it = cache.find(index);
+                if (it != cache.end())
+                    kept.emplace(index, it->second);
+            }
+            cache.swap(kept);
+        }
+    }
+
+    Triangle &triangle(size_t index)
+    {
+        std::unordered_map<size_t, Triangle>::iterator it = cache.find(index);
+        if (it == cache.end())
+        {
+            Triangle built = instanceTriangle(baseTriangle, instanceTranslation((unsigned int)index, N),
+                                              animatedRotation(seed, (unsigned int)index, time));
+            it = cache.emplace(index, built).first;
+        }
+        return it->second;
+    }
+
+    size_t cachedCount() const
+    {
+        return cache.size();
+    }
+
+private:
+    unsigned int seed;
+    unsigned int N;
+    size_t instanceCount;
+    glm::mat3 baseTriangle;
+    float reach;
+    float time;
+    std::unordered_map<size_t, Triangle> cache;
+};
+
+#endif
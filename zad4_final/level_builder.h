@@ -0,0 +1,166 @@
+#ifndef LEVEL_BUILDER_H
+#define LEVEL_BUILDER_H
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+
+#include "learnopengl/gl_owner.h"
+#include "instance_pages.h"
+#include "scene_store.h"
+#include "bvh.h"
+
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <iostream>
+
+// everything a level is made of: its instances on the host and the GPU and the BVH over their triangles
+struct BuiltLevel
+{
+    unsigned int seed;
+    unsigned int N;
+    size_t instanceCount;
+    SceneStore scene;
+    InstancePages pages;
+    std::unique_ptr<BVH> bvh;
+    // generation, upload and BVH build
+    double seconds;
+
+    BuiltLevel(const glm::mat3 &baseTriangle, unsigned int meshVBO, size_t instancesPerPage)
+        : seed(0), N(0), instanceCount(0), scene(baseTriangle), pages(meshVBO, instancesPerPage), bvh(new BVH()),
+          seconds(0.0)
+    {
+    }
+};
+
+// Builds a new level while the current one keeps being played. A worker thread generates the
+// instances, uploads them through a hidden window's context that shares objects with the drawing one,
+// fences the uploads and builds the collision BVH; the drawing thread picks the level up with take()
+// at a frame boundary, once the fence has passed, and only has to create the pages' VAOs
+// (InstancePages::createVertexArrays, VAOs are never shared between contexts). The level it replaces
+// is handed to retire(), which frees it on another thread, as the old BVH and scene can take
+// longer to free than a frame lasts.
+class LevelBuilder : private GLOwner
+{
+public:
+    // on the drawing thread, with mainWindow's context current
+    // morton and slotLookup are passed on to SceneStore::build
+    LevelBuilder(GLFWwindow* mainWindow, unsigned int meshVBO, size_t instancesPerPage, const glm::mat3 &baseTriangle,
+                 bool morton, bool slotLookup)
+        : meshVBO(meshVBO), pageSize(instancesPerPage), baseTriangle(baseTriangle), morton(morton), slotLookup(slotLookup),
+          fence(0), ready(false)
+    {
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        context = glfwCreateWindow(1, 1, "level builder", NULL, mainWindow);
+        glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+        if (context == nullptr)
+            std::cout << "no shared GL context, the level can't be regenerated while running" << std::endl;
+    }
+
+    ~LevelBuilder()
+    {
+        if (worker.joinable())
+            worker.join();
+        if (retirer.joinable())
+            retirer.join();
+        if (glReleasable() && fence != 0)
+            glDeleteSync(fence);
+        built.reset();
+        if (context != nullptr)
+            glfwDestroyWindow(context);
+    }
+
+    bool available() const
+    {
+        return context != nullptr;
+    }
+
+    // a level is being built or waits to be taken
+    bool busy() const
+    {
+        return worker.joinable();
+    }
+
+    // start building the level of (seed, N); false if one is already in progress
+    // ------------------------------------------------------------------------
+    bool start(unsigned int seed, unsigned int N)
+    {
+        if (!available() || busy())
+            return false;
+        worker = std::thread([this, seed, N]() { build(seed, N); });
+        return true;
+    }
+
+    // the finished level once its uploads have completed, otherwise null; drawing thread only
+    // ------------------------------------------------------------------------
+    std::unique_ptr<BuiltLevel> take()
+    {
+        if (!ready.load())
+            return nullptr;
+        if (fence != 0)
+        {
+            if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+                return nullptr;
+            glDeleteSync(fence);
+            fence = 0;
+        }
+        worker.join();
+        ready = false;
+        return std::move(built);
+    }
+
+    // free a level that is no longer drawn: its GL objects right away, the rest on another thread
+    // ------------------------------------------------------------------------
+    void retire(std::unique_ptr<BuiltLevel> level)
+    {
+        level->pages.release();
+        if (retirer.joinable())
+            retirer.join();
+        BuiltLevel* old = level.release();
+        retirer = std::thread([old]() { delete old; });
+    }
+
+private:
+    GLFWwindow* context;
+    unsigned int meshVBO;
+    size_t pageSize;
+    glm::mat3 baseTriangle;
+    bool morton;
+    bool slotLookup;
+
+    std::thread worker;
+    std::thread retirer;
+    // written by the worker before ready is set, read by take() after
+    std::unique_ptr<BuiltLevel> built;
+    GLsync fence;
+    std::atomic<bool> ready;
+
+    void build(unsigned int seed, unsigned int N)
+    {
+        double start = glfwGetTime();
+        std::unique_ptr<BuiltLevel> level(new BuiltLevel(baseTriangle, meshVBO, pageSize));
+        level->seed = seed;
+        level->N = N;
+        level->instanceCount = (size_t)N * N * N - 1;
+        level->scene.build(N, level->instanceCount, morton, slotLookup);
+        level->scene.generate(seed, N);
+
+        glfwMakeContextCurrent(context);
+        level->scene.uploadPages(level->pages);
+        fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glFlush();
+        glfwMakeContextCurrent(nullptr);
+
+        std::vector<AABB> triangleBoxes;
+        level->scene.triangleBoxes(triangleBoxes);
+        level->bvh->build(triangleBoxes);
+
+        level->seconds = glfwGetTime() - start;
+        built = std::move(level);
+        ready = true;
+    }
+};
+
+#endif
@@ -0,0 +1,31 @@
+// levelpack: writes the N*N*N cube level of a seed as a level file for the endless mode
+//   ./levelpack level.lvl seed N
+// cut into chunks (see chunk_stream.h); ./instancing_quads --level-file level.lvl then streams the
+// cube from the file and generates the endless level around it
+#include <GL/glew.h>
+
+#include "chunk_stream.h"
+
+#include <iostream>
+#include <stdlib.h>
+
+int main( int argc, char** argv )
+{
+    if (argc != 4 || atoi(argv[3]) <= 0 || atoi(argv[3]) > (int)MAX_LEVEL_SIZE)
+    {
+        std::cout << "usage: " << argv[0] << " level.lvl seed N, N up to " << MAX_LEVEL_SIZE << std::endl;
+        return 1;
+    }
+    unsigned int seed = atoi(argv[2]);
+    unsigned int N = atoi(argv[3]);
+    if (!writeLevelFile(argv[1], seed, N))
+    {
+        std::cout << argv[1] << ": can't write" << std::endl;
+        return 1;
+    }
+    size_t chunksPerSide = (N + CHUNK_CELLS - 1) / CHUNK_CELLS;
+    std::cout << argv[1] << ": " << (size_t)N * N * N - 1 << " instances of seed " << seed << ", "
+              << chunksPerSide * chunksPerSide * chunksPerSide * CHUNK_INSTANCES - 1 << " with the edge chunks filled up"
+              << std::endl;
+    return 0;
+}
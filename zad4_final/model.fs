@@ -0,0 +1,37 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+in vec3 Normal;
+flat in uint materialIndex;
+
+// MaterialLibrary: one array per texture size, a material is (diffuse, specular, normal, height),
+// each (array << 16 | layer) or -1
+uniform sampler2DArray materialArrays[4];
+layout (std140) uniform Materials
+{
+    ivec4 materials[256];
+};
+
+vec4 sampleMaterial(int reference, vec2 uv)
+{
+    if (reference < 0)
+        return vec4(1.0);
+    // sampler arrays can only be indexed with constants in GLSL 3.30
+    vec3 coords = vec3(uv, float(reference & 0xffff));
+    int array = reference >> 16;
+    if (array == 0)
+        return texture(materialArrays[0], coords);
+    else if (array == 1)
+        return texture(materialArrays[1], coords);
+    else if (array == 2)
+        return texture(materialArrays[2], coords);
+    return texture(materialArrays[3], coords);
+}
+
+void main()
+{
+    // fixed light from above, enough to see the shape of an obstacle
+    float light = 0.3 + 0.7 * max(dot(normalize(Normal), normalize(vec3(0.3, 1.0, 0.5))), 0.0);
+    FragColor = vec4(sampleMaterial(materials[materialIndex].x, TexCoords).rgb * light, 1.0);
+}
@@ -0,0 +1,21 @@
+#version 330 core
+#include "packed_vertex.glsl"
+
+out vec2 TexCoords;
+out vec3 Normal;
+flat out uint materialIndex;
+
+layout (std140) uniform Matrices
+{
+    mat4 projection;
+    mat4 view;
+};
+uniform mat4 model;
+
+void main()
+{
+    TexCoords = aTexCoords;
+    Normal = mat3(model) * decodeNormal();
+    materialIndex = meshMaterial;
+    gl_Position = projection * view * model * vec4(decodePosition(), 1.0);
+}
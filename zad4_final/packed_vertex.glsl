@@ -0,0 +1,36 @@
+// Decoding of PackedVertex (learnopengl/packed_vertex.h), for shaders drawing Mesh/Model:
+//  location 0  vec4 position: xyz in [0, 1] of the mesh bounds, w the bitangent sign
+//  location 1  vec2 octahedral normal
+//  location 2  vec2 texture coordinates
+//  location 3  vec2 octahedral tangent, not read yet (nothing is normal mapped); the bitangent would
+//              be cross(normal, tangent) times the sign in position.w
+//  location 4  vec3 bounds minimum  } per draw: a constant attribute (Mesh::Draw) or an instanced
+//  location 5  vec3 bounds extent   } one selected by baseInstance (MeshBuffer)
+//  location 6  uint material index  }
+
+layout (location = 0) in vec4 aPackedPosition;
+layout (location = 1) in vec2 aPackedNormal;
+layout (location = 2) in vec2 aTexCoords;
+layout (location = 3) in vec2 aPackedTangent;
+layout (location = 4) in vec3 meshBoundsMin;
+layout (location = 5) in vec3 meshBoundsExtent;
+layout (location = 6) in uint meshMaterial;
+
+vec3 octahedralDecode(vec2 e)
+{
+    vec3 n = vec3(e.x, e.y, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+vec3 decodePosition()
+{
+    return meshBoundsMin + aPackedPosition.xyz * meshBoundsExtent;
+}
+
+vec3 decodeNormal()
+{
+    return octahedralDecode(aPackedNormal);
+}
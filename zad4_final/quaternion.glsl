@@ -0,0 +1,30 @@
+// Quaternion helpers shared by the shaders and the C++ side.
+// Written in the subset of GLSL that glm also understands, so quaternion.h can #include
+// this file and the CPU builds exactly the same matrices as the vertex shader.
+
+// rotation matrix of the instance quaternion (x, y, z, w); the columns are the rows of the
+// textbook matrix, i.e. it rotates by the conjugate, which is what the levels were built with
+mat3 quatToMat3(vec4 q)
+{
+    vec3 v_x = vec3(1.0f - (2.0f*(q.y*q.y)) - (2.0f*(q.z*q.z)),
+                    2.0f*q.x*q.y - 2.0f*q.z*q.w,
+                    2.0f*q.x*q.z + 2.0f*q.y*q.w);
+
+    vec3 v_y = vec3(2.0f*q.x*q.y + 2.0f*q.z*q.w,
+                    1.0f - (2.0f*(q.x*q.x)) - (2.0f*(q.z*q.z)),
+                    2.0f*q.y*q.z - 2.0f*q.x*q.w);
+
+    vec3 v_z = vec3(2.0f*q.x*q.z - 2.0f*q.y*q.w,
+                    2.0f*q.y*q.z + 2.0f*q.x*q.w,
+                    1.0f - (2.0f*(q.x*q.x)) - (2.0f*(q.y*q.y)));
+
+    return mat3(v_x, v_y, v_z);
+}
+
+// rotates v exactly like quatToMat3(q) * v (by the conjugate of q), without building the matrix
+vec3 quatRotate(vec4 q, vec3 v)
+{
+    vec3 u = vec3(-q.x, -q.y, -q.z);
+    vec3 t = 2.0f * cross(u, v);
+    return v + q.w * t + cross(u, t);
+}
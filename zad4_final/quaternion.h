@@ -0,0 +1,16 @@
+#ifndef QUATERNION_H
+#define QUATERNION_H
+
+#include <glm/glm.hpp>
+
+// quaternion.glsl is valid C++ against glm, pull it in so the CPU side doesn't keep its own copy
+namespace glsl
+{
+    using namespace glm;
+    #include "quaternion.glsl"
+}
+
+using glsl::quatToMat3;
+using glsl::quatRotate;
+
+#endif
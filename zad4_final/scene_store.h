@@ -0,0 +1,162 @@
+#ifndef SCENE_STORE_H
+#define SCENE_STORE_H
+
+#include <glm/glm.hpp>
+
+#include "collision.h"
+#include "level.h"
+#include "bvh.h"
+#include "instance_pages.h"
+
+#include <vector>
+#include <iostream>
+
+// The instances of a level, kept once on the host as structure-of-arrays columns indexed by slot.
+// Everything else is a view of the columns: the GPU pages are uploaded straight from ranges of
+// them and a collision triangle is built from a slot's translation and rotation when it's needed
+// (instanceTriangle, with the same quatToMat3 the vertex shader runs), so there is no second copy
+// of the level in triangles or per-page staging vectors.
+// Slots follow the Morton (Z-order) curve through the grid cells by default, so instances close in
+// space are mostly close in memory along all three axes, not only along x as in generation order.
+// Instance indices keep their meaning: every instance is still a function of (seed, N, index),
+// index 0 is still the goal, and the GPU pages carry the index of every slot for the compute shaders.
+class SceneStore
+{
+public:
+    // per slot; translations and rotations stay empty for a level generated on the GPU
+    std::vector<glm::vec3> translations;
+    std::vector<glm::vec4> rotations;
+    // instance index of every slot
+    std::vector<unsigned int> indices;
+    // per instance index: its slot; only built on request, for the CPU --spin path, which
+    // finds instance indices near the sphere and has to update their slots
+    std::vector<unsigned int> slots;
+
+    SceneStore(const glm::mat3 &baseTriangle) : baseTriangle(baseTriangle)
+    {
+    }
+
+    // lay out the slots of a level; morton false keeps generation order (z, y, x), for comparison,
+    // slotLookup fills slots as well
+    // ------------------------------------------------------------------------
+    void build(unsigned int N, size_t instanceCount, bool morton, bool slotLookup)
+    {
+        translations.clear();
+        rotations.clear();
+        indices.clear();
+        slots.clear();
+        indices.reserve(instanceCount);
+        if (morton)
+        {
+            unsigned int side = 1;
+            while (side < N)
+                side *= 2;
+            visit(N, instanceCount, 0, 0, 0, side);
+        }
+        else
+        {
+            for (size_t index = 0; index < instanceCount; index++)
+                indices.push_back((unsigned int)index);
+        }
+
+        if (!slotLookup)
+            return;
+        slots.resize(instanceCount);
+        for (size_t slot = 0; slot < indices.size(); slot++)
+            slots[indices[slot]] = (unsigned int)slot;
+    }
+
+    // fill the translation and rotation of every slot on the CPU
+    // ------------------------------------------------------------------------
+    void generate(unsigned int seed, unsigned int N)
+    {
+        translations.resize(indices.size());
+        rotations.resize(indices.size());
+        for (size_t slot = 0; slot < indices.size(); slot++)
+        {
+            translations[slot] = instanceTranslation(indices[slot], N);
+            rotations[slot] = instanceRotation(seed, indices[slot]);
+        }
+    }
+
+    size_t size() const
+    {
+        return indices.size();
+    }
+
+    // the pages' buffers from the columns, page by page; without generated columns they are only
+    // allocated (for levelgen.comp). No VAOs, see InstancePages
+    // ------------------------------------------------------------------------
+    void uploadPages(InstancePages &pages) const
+    {
+        bool generated = !translations.empty();
+        for (size_t first = 0; first < indices.size(); first += pages.instancesPerPage())
+        {
+            size_t count = std::min(pages.instancesPerPage(), indices.size() - first);
+            pages.appendBuffers(generated ? &translations[first] : nullptr, generated ? &rotations[first] : nullptr,
+                                &indices[first], count);
+        }
+    }
+
+    Triangle triangle(size_t slot) const
+    {
+        return instanceTriangle(baseTriangle, translations[slot], rotations[slot]);
+    }
+
+    // bounds of every slot's triangle, what the collision BVH is built from
+    // ------------------------------------------------------------------------
+    void triangleBoxes(std::vector<AABB> &boxes) const
+    {
+        boxes.clear();
+        boxes.reserve(translations.size());
+        for (size_t slot = 0; slot < translations.size(); slot++)
+            boxes.push_back(triangleBounds(triangle(slot)));
+    }
+
+    void swap(SceneStore &other)
+    {
+        translations.swap(other.translations);
+        rotations.swap(other.rotations);
+        indices.swap(other.indices);
+        slots.swap(other.slots);
+        std::swap(baseTriangle, other.baseTriangle);
+    }
+
+    size_t bytes() const
+    {
+        return translations.size() * sizeof(glm::vec3) + rotations.size() * sizeof(glm::vec4) +
+               (indices.size() + slots.size()) * sizeof(unsigned int);
+    }
+
+    void printMemory() const
+    {
+        std::cout << "scene store: " << size() << " slots, translations " << translations.size() * sizeof(glm::vec3) / 1024
+                  << "KB, rotations " << rotations.size() * sizeof(glm::vec4) / 1024
+                  << "KB, indices " << indices.size() * sizeof(unsigned int) / 1024
+                  << "KB, slots " << slots.size() * sizeof(unsigned int) / 1024
+                  << (slots.empty() ? "KB (not needed), " : "KB, ") << bytes() / 1024 << "KB in all" << std::endl;
+    }
+
+private:
+    glm::mat3 baseTriangle;
+
+    // the cells of a power-of-two cube in Morton order (x in the lowest bit), skipping the octants
+    // that lie outside the N*N*N grid, so the work stays proportional to the instance count
+    void visit(unsigned int N, size_t instanceCount, unsigned int x, unsigned int y, unsigned int z, unsigned int size)
+    {
+        if (x >= N || y >= N || z >= N)
+            return;
+        if (size == 1)
+        {
+            size_t index = ((size_t)z * N + y) * N + x;
+            if (index < instanceCount)
+                indices.push_back((unsigned int)index);
+            return;
+        }
+        unsigned int half = size / 2;
+        for (unsigned int child = 0; child < 8; child++)
+            visit(N, instanceCount, x + (child & 1) * half, y + ((child >> 1) & 1) * half, z + ((child >> 2) & 1) * half, half);
+    }
+};
+
+#endif
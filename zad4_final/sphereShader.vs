@@ -4,11 +4,24 @@ layout (location = 1) in vec3 aColor;
 
 out vec3 fColor;
 
-uniform mat4 projection;
-uniform mat4 view;
+layout (std140) uniform Matrices
+{
+    mat4 projection;
+    mat4 view;
+};
+// INSTANCED_MOVE takes the position per instance from a vertex attribute (debug markers)
+#ifdef INSTANCED_MOVE
+layout (location = 2) in vec3 move;
+#else
 uniform vec3 move;
+#endif
 
+// SCALE bakes the size in for the fixed-size variants (player sphere, debug markers)
+#ifdef SCALE
+const float scale = SCALE;
+#else
 uniform float scale;
+#endif
 
 vec3 hsv2rgb(vec3 c)
 {
@@ -0,0 +1,77 @@
+// texpack: precomputes the mip chains of textures, so loading them needs neither stb nor glGenerateMipmap
+//   ./texpack [--bc] image...
+// writes "<image>.mips" (RGBA8) next to every image, with --bc also "<image>.bc.mips" (BC3);
+// TextureCache picks them up as long as they are newer than the image (see learnopengl/mip_chain.h)
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+#include "learnopengl/mip_chain.h"
+
+#include <iostream>
+#include <string.h>
+#include <vector>
+#include <chrono>
+
+int main( int argc, char** argv )
+{
+    bool compress = false;
+    std::vector<const char*> images;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--bc") == 0)
+            compress = true;
+        else
+            images.push_back(argv[i]);
+    }
+    if (images.empty())
+    {
+        std::cout << "usage: " << argv[0] << " [--bc] image..." << std::endl;
+        return 1;
+    }
+
+    int failures = 0;
+    for (const char* path : images)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        int width, height, components;
+        unsigned char* data = stbi_load(path, &width, &height, &components, 4);
+        if (data == nullptr)
+        {
+            std::cout << path << ": can't decode: " << stbi_failure_reason() << std::endl;
+            failures++;
+            continue;
+        }
+        std::vector<MipLevel> levels = buildMipChain(data, width, height);
+        stbi_image_free(data);
+
+        size_t bytes = 0;
+        for (const MipLevel &level : levels)
+            bytes += level.data.size();
+        bool ok = writeMipFile(std::string(path) + ".mips", MIP_RGBA8, levels);
+
+        size_t compressedBytes = 0;
+        if (ok && compress)
+        {
+            std::vector<MipLevel> compressed;
+            for (const MipLevel &level : levels)
+            {
+                compressed.push_back(compressBC3(level));
+                compressedBytes += compressed.back().data.size();
+            }
+            ok = writeMipFile(std::string(path) + ".bc.mips", MIP_BC3, compressed);
+        }
+        if (!ok)
+        {
+            std::cout << path << ": can't write the mip files" << std::endl;
+            failures++;
+            continue;
+        }
+
+        double ms = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1000.0;
+        std::cout << path << ": " << width << "x" << height << ", " << levels.size() << " levels, " << bytes / 1024 << "KB";
+        if (compress)
+            std::cout << ", " << compressedBytes / 1024 << "KB BC3";
+        std::cout << " (" << ms << "ms)" << std::endl;
+    }
+    return failures == 0 ? 0 : 1;
+}